@@ -0,0 +1,162 @@
+#ifndef LEAttributeIndex_H
+#define LEAttributeIndex_H
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+#include <vector>
+#include <LEUUIDKey.h>
+
+/**
+ * @brief Remote attributes of the connected peer keyed by (service, characteristic, descriptor) UUID
+ * and by attribute handle, built once per connection with the UUIDs already in binary form.
+ */
+class LEAttributeIndex
+{
+public:
+  struct Entry
+  {
+    LEUUIDKey service;
+    LEUUIDKey characteristic;
+    LEUUIDKey descriptor; // all zero for the characteristic value itself
+    uint16_t handle;
+    uint8_t properties;   // ESP_GATT_CHAR_PROP_BIT_*, characteristics only
+    BLERemoteCharacteristic *remoteCharacteristic; // NULL when built from a cached layout
+    BLERemoteDescriptor *remoteDescriptor;         // descriptors only
+  };
+
+private:
+  static const uint16_t EMPTY = 0xFFFF;
+
+  std::vector<Entry> _entries;
+  std::vector<uint16_t> _slots;
+  std::vector<uint16_t> _handleSlots;
+
+  static uint32_t hash(const LEUUIDKey &service, const LEUUIDKey &characteristic, const LEUUIDKey &descriptor)
+  {
+    return (service.hash() * 31 + characteristic.hash()) * 31 + descriptor.hash();
+  }
+  static uint32_t hashHandle(uint16_t handle) { return handle * 2654435761u; }
+
+  void insert(uint16_t index)
+  {
+    const Entry &entry = _entries[index];
+    size_t mask = _slots.size() - 1;
+    size_t slot = hash(entry.service, entry.characteristic, entry.descriptor) & mask;
+    bool duplicate = false;
+    while (_slots[slot] != EMPTY)
+    {
+      // keep the first instance when a UUID repeats within its parent
+      const Entry &other = _entries[_slots[slot]];
+      duplicate = duplicate || (other.service == entry.service && other.characteristic == entry.characteristic && other.descriptor == entry.descriptor);
+      slot = (slot + 1) & mask;
+    }
+    if (!duplicate)
+      _slots[slot] = index;
+
+    mask = _handleSlots.size() - 1;
+    slot = hashHandle(entry.handle) & mask;
+    while (_handleSlots[slot] != EMPTY)
+      slot = (slot + 1) & mask;
+    _handleSlots[slot] = index;
+  }
+
+  bool rehash(size_t count)
+  {
+    // keep the load factor at or below one half
+    size_t slotCount = _slots.empty() ? 32 : _slots.size();
+    while (slotCount < count * 2)
+      slotCount *= 2;
+    if (slotCount == _slots.size())
+      return false;
+
+    _slots.assign(slotCount, (uint16_t)EMPTY);
+    _handleSlots.assign(slotCount, (uint16_t)EMPTY);
+    for (size_t i = 0; i < _entries.size(); i++)
+      insert(i);
+    return true;
+  }
+
+public:
+  static LEUUIDKey none()
+  {
+    LEUUIDKey key;
+    memset(key.bytes, 0, sizeof(key.bytes));
+    return key;
+  }
+
+  void reserve(size_t count)
+  {
+    _entries.reserve(count);
+    rehash(count);
+  }
+
+  bool add(const Entry &entry)
+  {
+    if (_entries.size() >= EMPTY - 1)
+      return false;
+    _entries.push_back(entry);
+    if (!rehash(_entries.size()))
+      insert(_entries.size() - 1);
+    return true;
+  }
+
+  const Entry *find(const LEUUIDKey &service, const LEUUIDKey &characteristic, const LEUUIDKey &descriptor) const
+  {
+    if (_slots.empty())
+      return nullptr;
+
+    size_t mask = _slots.size() - 1;
+    size_t slot = hash(service, characteristic, descriptor) & mask;
+    while (_slots[slot] != EMPTY)
+    {
+      const Entry &entry = _entries[_slots[slot]];
+      if (entry.characteristic == characteristic && entry.service == service && entry.descriptor == descriptor)
+        return &entry;
+      slot = (slot + 1) & mask;
+    }
+    return nullptr;
+  }
+
+  const Entry *find(const LEUUIDKey &service, const LEUUIDKey &characteristic) const { return find(service, characteristic, none()); }
+
+  /**
+   * @brief Parses the UUID strings on the stack, descriptor_uuid NULL selects the characteristic.
+   */
+  const Entry *find(const char *service_uuid, const char *characteristic_uuid, const char *descriptor_uuid = nullptr) const
+  {
+    LEUUIDKey service, characteristic, descriptor = none();
+    if (!LEUUIDKey::fromString(service_uuid, service) || !LEUUIDKey::fromString(characteristic_uuid, characteristic))
+      return nullptr;
+    if (descriptor_uuid != nullptr && !LEUUIDKey::fromString(descriptor_uuid, descriptor))
+      return nullptr;
+    return find(service, characteristic, descriptor);
+  }
+
+  const Entry *findHandle(uint16_t handle) const
+  {
+    if (_handleSlots.empty())
+      return nullptr;
+
+    size_t mask = _handleSlots.size() - 1;
+    size_t slot = hashHandle(handle) & mask;
+    while (_handleSlots[slot] != EMPTY)
+    {
+      if (_entries[_handleSlots[slot]].handle == handle)
+        return &_entries[_handleSlots[slot]];
+      slot = (slot + 1) & mask;
+    }
+    return nullptr;
+  }
+
+  const Entry *get(size_t index) const { return index < _entries.size() ? &_entries[index] : nullptr; }
+  size_t count() const { return _entries.size(); }
+
+  void clear()
+  {
+    _entries.clear();
+    _slots.clear();
+    _handleSlots.clear();
+  }
+};
+
+#endif // LEAttributeIndex_H
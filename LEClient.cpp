@@ -4,17 +4,675 @@ volatile bool AutoReconnectFlag = false;
 const char *pServer_name;
 
 BLEAddress *pServerAddress;
+BLEAddress *serverAddress;  // storage behind pServerAddress after a name scan
+BLEAddress *scannedAddress; // reused by every name scan, sessions included
+esp_ble_addr_type_t scannedAddressType;
+volatile bool serverFound;
 BLEScan *pBLEScan;
 BLEClient *pClient;
 
 AdvertisedDeviceCallbacks advertisedDeviceCallbacks;
 ClientCallbacks clientCallbacks;
+LEScanStore scanStore;
+
+struct LENotifyTarget
+{
+    BLEClient *client;                       // the connection it belongs to, pClient or a session's
+    BLERemoteCharacteristic *characteristic; // replaced after a reconnect
+    BLEUUID service;
+    BLEUUID uuid;
+    uint16_t handle; // routed by handleGattcEvent when restored from a cached layout, else 0
+    LENotifyCallback callback;
+    LEStreamCallback streamCallback;
+    LENotifyFunction function; // behind callback / streamCallback when set through the std::function overloads
+    LEStreamFunction streamFunction;
+    LEStreamReassembler *stream;
+    LENotifyRing *ring;
+};
+
+// appended by the user task, walked by the BLE task: a slot is filled before the count publishes it
+LENotifyTarget *notifyTargets[LE_MAX_NOTIFY_TARGETS];
+std::atomic<size_t> notifyTargetCount(0);
+LEClientDispatcher clientEvents;
+
+volatile LEConnectState connectState = LEConnectIdle;
+LEConnectCallback connectCallback;
+esp_timer_handle_t connectWatchdog = nullptr;
+volatile bool connectTimedOut = false;
+
+// one handle based request at a time, completed by handleGattcEvent on the BLE task
+struct LEGattRequest
+{
+    SemaphoreHandle_t lock;
+    SemaphoreHandle_t done;
+    volatile bool pending;
+    esp_gattc_cb_event_t event;
+    esp_gatt_if_t gattcIf;
+    uint16_t connId;
+    uint16_t handle; // ignored for Read Multiple, whose response carries none
+    uint8_t *buffer;
+    size_t capacity;
+    size_t length; // full value length, may exceed capacity
+    esp_gatt_status_t status;
+};
+LEGattRequest gattRequest = {nullptr, nullptr, false, ESP_GATTC_READ_CHAR_EVT, 0, 0, 0, nullptr, 0, 0, ESP_GATT_OK};
+
+// one bulk write at a time, paced on its own task
+struct LEBulkWrite
+{
+    TaskHandle_t task;
+    SemaphoreHandle_t uncongested;
+    volatile bool congested;
+    volatile bool busy;
+    BLEClient *client;
+    uint16_t handle;
+    const uint8_t *data;
+    size_t length;
+    LEWriteCallback callback;
+    LEWriteStats stats;
+};
+LEBulkWrite bulkWrite;
+
+// effective settings of every open link, keyed by conn_id: the stack reports a connection to every
+// registered GATT client interface, but conn_id names the link itself
+struct LELinkSlot
+{
+    bool active;
+    LELinkInfo info;
+};
+LELinkSlot links[1 + LE_MAX_SESSIONS]; // the single-peer connection and the sessions
+portMUX_TYPE linkLock = portMUX_INITIALIZER_UNLOCKED;
+LELinkTuner linkTuner;
+LELinkParams linkParams; // all zero until setLinkParams
+LELinkCallback linkCallback;
+
+static void deliverClientEvent(const LEClientEvent &event, void *context)
+{
+    if (event.type == LEClientEvent::Notify)
+    {
+        LENotifyTarget *target = (LENotifyTarget *)event.target;
+        if (target->callback)
+            target->callback(event.characteristic, (uint8_t *)event.data, event.length, event.isNotify);
+    }
+    else if (event.type == LEClientEvent::Stream)
+    {
+        LENotifyTarget *target = (LENotifyTarget *)event.target;
+        if (target->streamCallback)
+            target->streamCallback(target->stream->data(), target->stream->length());
+        target->stream->release();
+    }
+    else if (event.type == LEClientEvent::WriteComplete)
+    {
+        LEWriteStats stats;
+        memcpy(&stats, event.data, sizeof(stats));
+        // busy stays set until here, a new writeBulk cannot replace the callback first
+        bulkWrite.callback(stats);
+        bulkWrite.busy = false;
+    }
+    else if (event.type == LEClientEvent::Link)
+    {
+        LELinkInfo info;
+        memcpy(&info, event.data, sizeof(info));
+        if (linkCallback)
+            linkCallback(info);
+    }
+    else if (event.type == LEClientEvent::Progress)
+    {
+        if (connectCallback)
+            connectCallback((LEConnectState)event.data[0], event.data[1]);
+    }
+    else if (event.type == LEClientEvent::Advertisement)
+    {
+        LEAdvertisement advertisement;
+        memcpy(&advertisement, event.data, sizeof(advertisement));
+        AdvertisedDeviceCallbacks *callbacks = (AdvertisedDeviceCallbacks *)event.target;
+        if (callbacks->advertisementCallback)
+            callbacks->advertisementCallback(advertisement);
+    }
+    else
+    {
+        ((ClientCallbacks *)event.target)->deliver(event.type);
+    }
+}
+
+// a queued Stream event holds its reassembler until delivered, give it back when the event is dropped instead
+static void releaseClientEvent(const LEClientEvent &event, void *context)
+{
+    if (event.type == LEClientEvent::Stream)
+    {
+        ((LENotifyTarget *)event.target)->stream->release();
+    }
+    else if (event.type == LEClientEvent::WriteComplete)
+    {
+        // the writer must still learn its buffer is free, report on the evicting task
+        LEWriteStats stats;
+        memcpy(&stats, event.data, sizeof(stats));
+        bulkWrite.callback(stats);
+        bulkWrite.busy = false;
+    }
+}
+
+static void onScanComplete(BLEScanResults results)
+{
+    // a background scan has no duration, it only ends when the controller stops it
+    advertisedDeviceCallbacks._continuous = false;
+}
+
+// blocking scans share the controller with the background scan
+static bool pauseScan()
+{
+    if (!advertisedDeviceCallbacks._continuous)
+        return false;
+    advertisedDeviceCallbacks._continuous = false;
+    pBLEScan->stop();
+    return true;
+}
+
+static void resumeScan(bool paused)
+{
+    if (!paused)
+        return;
+    scanStore.setEvictOldest(true);
+    if (pBLEScan->start(0, onScanComplete, true))
+        advertisedDeviceCallbacks._continuous = true;
+}
+
+static void setConnectState(LEConnectState state, uint8_t attempt)
+{
+    connectState = state;
+    if (!connectCallback)
+        return;
+    if (!clientEvents.isDeferred())
+    {
+        connectCallback(state, attempt);
+        return;
+    }
+
+    LEClientEvent event;
+    event.type = LEClientEvent::Progress;
+    event.target = nullptr;
+    event.length = 2;
+    event.data[0] = state;
+    event.data[1] = attempt;
+    clientEvents.post(event);
+}
+
+static bool isConnecting(LEConnectState state)
+{
+    return state != LEConnectIdle && state != LEConnectReady && state != LEConnectFailed;
+}
+
+static void onConnectTimeout(void *arg)
+{
+    // a stalled discovery ends with the link. The GATTC API cannot cancel a pending open, BLEClient::connect
+    // returns when the stack's own link establishment timeout fires and a late success is dropped by the caller
+    connectTimedOut = true;
+    if (pClient->isConnected())
+        pClient->disconnect();
+}
+
+// blocking name scan, the match lands in scannedAddress
+static bool scanForName(const char *server_name, uint32_t scan_duration)
+{
+    pServer_name = server_name;
+    serverFound = false;
+    bool paused = pauseScan();
+    pBLEScan->start(scan_duration);
+    pBLEScan->clearResults();
+    pServer_name = nullptr;
+    resumeScan(paused);
+    return serverFound;
+}
+
+// the single-peer connection keeps its own copy, a later session scan must not move its reconnect target
+static void setServerAddress(const BLEAddress &address)
+{
+    if (serverAddress == nullptr)
+        serverAddress = new BLEAddress(address);
+    else
+        *serverAddress = address;
+    pServerAddress = serverAddress;
+}
+
+static BLEClient *getOwner(BLERemoteCharacteristic *characteristic)
+{
+    return characteristic->getRemoteService()->getClient();
+}
+
+static bool beginRequest(BLEClient *client, esp_gattc_cb_event_t event, uint16_t handle, uint8_t *buffer, size_t capacity)
+{
+    if (gattRequest.lock == nullptr || client == nullptr || !client->isConnected())
+        return false;
+    if (xSemaphoreTake(gattRequest.lock, pdMS_TO_TICKS(LE_GATT_TIMEOUT_MS)) != pdTRUE)
+        return false;
+
+    xSemaphoreTake(gattRequest.done, 0); // a completion that arrived after an earlier timeout
+    gattRequest.event = event;
+    gattRequest.gattcIf = client->getGattcIf();
+    gattRequest.connId = client->getConnId();
+    gattRequest.handle = handle;
+    gattRequest.buffer = buffer;
+    gattRequest.capacity = capacity;
+    gattRequest.length = 0;
+    gattRequest.status = ESP_GATT_ERROR;
+    gattRequest.pending = true;
+    return true;
+}
+
+static bool finishRequest(esp_err_t issued, size_t *length = nullptr)
+{
+    bool completed = issued == ESP_OK && xSemaphoreTake(gattRequest.done, pdMS_TO_TICKS(LE_GATT_TIMEOUT_MS)) == pdTRUE;
+    gattRequest.pending = false;
+    bool succeeded = completed && gattRequest.status == ESP_GATT_OK;
+    if (length != nullptr)
+        *length = succeeded ? gattRequest.length : 0;
+    xSemaphoreGive(gattRequest.lock);
+    return succeeded;
+}
+
+static void completeRequest(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t handle, esp_gatt_status_t status, const uint8_t *value, size_t length)
+{
+    // only a Read Multiple response carries no handle
+    if (!gattRequest.pending || gattRequest.event != event || gattc_if != gattRequest.gattcIf || conn_id != gattRequest.connId ||
+        (event != ESP_GATTC_READ_MULTIPLE_EVT && gattRequest.handle != handle))
+        return;
+
+    if (value != nullptr && gattRequest.buffer != nullptr)
+        memcpy(gattRequest.buffer, value, length < gattRequest.capacity ? length : gattRequest.capacity);
+    gattRequest.length = length;
+    gattRequest.status = status;
+    gattRequest.pending = false;
+    xSemaphoreGive(gattRequest.done);
+}
+
+static bool subscribeHandle(const LEGattCharacteristic &characteristic)
+{
+    if (characteristic.cccdHandle == 0)
+        return false;
+
+    esp_ble_gattc_register_for_notify(pClient->getGattcIf(), *pServerAddress->getNative(), characteristic.handle);
+    uint8_t value[2] = {(uint8_t)(characteristic.properties & ESP_GATT_CHAR_PROP_BIT_NOTIFY ? 0x01 : 0x02), 0x00};
+    if (!beginRequest(pClient, ESP_GATTC_WRITE_DESCR_EVT, characteristic.cccdHandle, nullptr, 0))
+        return false;
+    return finishRequest(esp_ble_gattc_write_char_descr(pClient->getGattcIf(), pClient->getConnId(), characteristic.cccdHandle,
+                                                        sizeof(value), value, ESP_GATT_WRITE_TYPE_RSP, ESP_GATT_AUTH_REQ_NONE));
+}
+
+static bool gattRead(BLEClient *client, uint16_t handle, uint8_t *buffer, size_t capacity, size_t *length)
+{
+    size_t received = 0;
+    if (handle == 0 || !beginRequest(client, ESP_GATTC_READ_CHAR_EVT, handle, buffer, capacity))
+        return false;
+    bool read = finishRequest(esp_ble_gattc_read_char(client->getGattcIf(), client->getConnId(), handle, ESP_GATT_AUTH_REQ_NONE), &received);
+    if (length != nullptr)
+        *length = received < capacity ? received : capacity;
+    return read && received <= capacity;
+}
+
+// read at its handle in layout, so the completion is matched by handle like any other read;
+// a changed database moves or drops the characteristic and the comparison then fails
+static bool readDatabaseHash(const LEGattLayout &layout, uint8_t *hash)
+{
+    const LEGattCharacteristic *characteristic = layout.find(LEUUIDKey::from16(0x1801), LEUUIDKey::from16(LE_GATT_DATABASE_HASH));
+    size_t length = 0;
+    return characteristic != nullptr && gattRead(pClient, characteristic->handle, hash, 16, &length) && length == 16;
+}
+
+static bool gattWrite(BLEClient *client, uint16_t handle, const uint8_t *data, size_t length, bool response)
+{
+    if (handle == 0 || client == nullptr || !client->isConnected())
+        return false;
+    if (!response)
+        return esp_ble_gattc_write_char(client->getGattcIf(), client->getConnId(), handle, length, (uint8_t *)data,
+                                        ESP_GATT_WRITE_TYPE_NO_RSP, ESP_GATT_AUTH_REQ_NONE) == ESP_OK;
+
+    if (!beginRequest(client, ESP_GATTC_WRITE_CHAR_EVT, handle, nullptr, 0))
+        return false;
+    return finishRequest(esp_ble_gattc_write_char(client->getGattcIf(), client->getConnId(), handle, length, (uint8_t *)data,
+                                                  ESP_GATT_WRITE_TYPE_RSP, ESP_GATT_AUTH_REQ_NONE));
+}
+
+// one Read Multiple request, false when the peer refused it or the values had other lengths
+static bool readGroup(BLEClient *client, LEReadItem *items, size_t count, size_t total)
+{
+    esp_gattc_multi_t multi;
+    multi.num_attr = count;
+    for (size_t i = 0; i < count; i++)
+        multi.handles[i] = items[i].handle;
+
+    uint8_t response[ESP_GATT_MAX_MTU_SIZE];
+    size_t length;
+    if (!beginRequest(client, ESP_GATTC_READ_MULTIPLE_EVT, 0, response, sizeof(response)))
+        return false;
+    if (!finishRequest(esp_ble_gattc_read_multiple(client->getGattcIf(), client->getConnId(), &multi, ESP_GATT_AUTH_REQ_NONE), &length) || length != total)
+        return false;
+
+    size_t offset = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        memcpy(items[i].buffer, response + offset, items[i].length);
+        items[i].received = items[i].length;
+        offset += items[i].length;
+    }
+    return true;
+}
+
+static bool gattReadMultiple(BLEClient *client, LEReadItem *items, size_t count)
+{
+    if (client == nullptr || !client->isConnected())
+        return false;
+
+    // a response holds at most MTU - 1 bytes, and one that fills it cannot be told from a truncated one
+    size_t payload = client->getMTU() > 1 ? client->getMTU() - 1 : 22;
+    bool all = true;
+    size_t first = 0;
+    while (first < count)
+    {
+        size_t last = first;
+        size_t total = 0;
+        while (last < count && last - first < ESP_GATT_MAX_READ_MULTI_HANDLES && total + items[last].length < payload)
+            total += items[last++].length;
+
+        if (last - first < 2 || !readGroup(client, items + first, last - first, total))
+        {
+            // ATT allows one outstanding request per link, so these go back to back
+            if (last == first)
+                last = first + 1; // longer than one response
+            for (size_t i = first; i < last; i++)
+            {
+                size_t length = 0;
+                bool read = gattRead(client, items[i].handle, items[i].buffer, items[i].length, &length);
+                items[i].received = read ? length : 0;
+                all = all && read;
+            }
+        }
+        first = last;
+    }
+    return all;
+}
+
+static void reportLink(const LELinkInfo &info)
+{
+    if (!linkCallback)
+        return;
+    if (!clientEvents.isDeferred())
+    {
+        linkCallback(info);
+        return;
+    }
+
+    LEClientEvent event;
+    static_assert(sizeof(LELinkInfo) <= sizeof(event.data), "LELinkInfo must fit in LE_EVENT_DATA_SIZE");
+    event.type = LEClientEvent::Link;
+    event.target = nullptr;
+    event.length = sizeof(info);
+    memcpy(event.data, &info, sizeof(info));
+    clientEvents.post(event);
+}
+
+static LELinkSlot *findLink(uint16_t conn_id)
+{
+    for (size_t i = 0; i < 1 + LE_MAX_SESSIONS; i++)
+    {
+        if (links[i].active && links[i].info.connId == conn_id)
+            return &links[i];
+    }
+    return nullptr;
+}
+
+static void openLink(esp_ble_gattc_cb_param_t *param)
+{
+    LELinkInfo info;
+    info.begin(param->connect.conn_id, param->connect.remote_bda, param->connect.conn_params);
+
+    portENTER_CRITICAL(&linkLock);
+    bool known = findLink(param->connect.conn_id) != nullptr;
+    for (size_t i = 0; !known && i < 1 + LE_MAX_SESSIONS; i++)
+    {
+        if (!links[i].active)
+        {
+            links[i].active = true;
+            links[i].info = info;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&linkLock);
+
+    if (known)
+        return; // the same link reported to another interface
+    linkTuner.request(param->connect.remote_bda, linkParams);
+    reportLink(info);
+}
+
+static void setLinkMtu(uint16_t conn_id, uint16_t mtu)
+{
+    LELinkInfo info;
+    portENTER_CRITICAL(&linkLock);
+    LELinkSlot *slot = findLink(conn_id);
+    if (slot != nullptr)
+    {
+        slot->info.mtu = mtu;
+        info = slot->info;
+    }
+    portEXIT_CRITICAL(&linkLock);
+
+    if (slot != nullptr)
+        reportLink(info);
+}
+
+static void closeLink(uint16_t conn_id)
+{
+    portENTER_CRITICAL(&linkLock);
+    LELinkSlot *slot = findLink(conn_id);
+    if (slot != nullptr)
+        slot->active = false;
+    portEXIT_CRITICAL(&linkLock);
+}
+
+static bool getLink(BLEClient *client, LELinkInfo &info)
+{
+    if (client == nullptr || !client->isConnected())
+        return false;
+    portENTER_CRITICAL(&linkLock);
+    LELinkSlot *slot = findLink(client->getConnId());
+    if (slot != nullptr)
+        info = slot->info;
+    portEXIT_CRITICAL(&linkLock);
+    return slot != nullptr;
+}
+
+static bool requestLink(BLEClient *client, const LELinkParams &params)
+{
+    LELinkInfo info;
+    if (!params.isValid() || !getLink(client, info))
+        return false;
+
+    // the MTU is exchanged once per connection and the local MTU is global, setLinkParams covers new links
+    if (params.mtu != 0 && params.mtu != info.mtu)
+        return false;
+    return linkTuner.request(info.address, params);
+}
+
+static void handleGapEvent(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+{
+    for (size_t i = 0; i < 1 + LE_MAX_SESSIONS; i++)
+    {
+        LELinkInfo info;
+        portENTER_CRITICAL(&linkLock);
+        bool changed = links[i].active && linkTuner.update(links[i].info, event, param);
+        if (changed)
+            info = links[i].info;
+        portEXIT_CRITICAL(&linkLock);
+
+        if (changed)
+            reportLink(info);
+    }
+}
+
+static void registerNotifyTarget(LENotifyTarget *target);
+static void detachNotifyTargets(BLEClient *client);
+static void onNotify(LENotifyTarget *target, BLERemoteCharacteristic *pCharacteristic, uint8_t *pData, size_t length, bool isNotify);
+
+// the characteristics of the previous link are gone, look every target of client up again by UUID,
+// in the cached layout when discovery was skipped (the single-peer connection only)
+static uint32_t restoreNotifyTargets(BLEClient *client, const LEGattLayout *cached)
+{
+    uint32_t restored = 0;
+    size_t count = notifyTargetCount.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; i++)
+    {
+        LENotifyTarget *target = notifyTargets[i];
+        if (target->client != client || (!target->callback && !target->streamCallback && target->ring == nullptr))
+            continue;
+        if (target->stream != nullptr)
+            target->stream->reset();
+
+        if (cached != nullptr)
+        {
+            const LEGattCharacteristic *entry = cached->find(LEUUIDKey::fromBLEUUID(target->service), LEUUIDKey::fromBLEUUID(target->uuid));
+            if (entry == nullptr)
+                continue;
+            target->characteristic = nullptr;
+            target->handle = entry->handle;
+            if (!subscribeHandle(*entry))
+                continue;
+        }
+        else
+        {
+            BLERemoteService *service = client->getService(target->service);
+            BLERemoteCharacteristic *characteristic = service != nullptr ? service->getCharacteristic(target->uuid) : nullptr;
+            if (characteristic == nullptr)
+                continue;
+            target->characteristic = characteristic;
+            target->handle = 0;
+            registerNotifyTarget(target);
+        }
+        restored++;
+    }
+    return restored;
+}
+
+static void handleGattcEvent(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param)
+{
+    switch (event)
+    {
+    case ESP_GATTC_READ_CHAR_EVT:
+    case ESP_GATTC_READ_DESCR_EVT:
+    case ESP_GATTC_READ_MULTIPLE_EVT:
+        completeRequest(event, gattc_if, param->read.conn_id, param->read.handle, param->read.status, param->read.value, param->read.value_len);
+        break;
+    case ESP_GATTC_WRITE_CHAR_EVT:
+    case ESP_GATTC_WRITE_DESCR_EVT:
+        completeRequest(event, gattc_if, param->write.conn_id, param->write.handle, param->write.status, nullptr, 0);
+        break;
+    case ESP_GATTC_NOTIFY_EVT:
+    {
+        // BLEClient only routes notifications to discovered characteristics
+        size_t count = notifyTargetCount.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; i++)
+        {
+            LENotifyTarget *target = notifyTargets[i];
+            BLEClient *client = target->client; // cleared when its session closes
+            if (client != nullptr && target->handle != 0 && target->handle == param->notify.handle &&
+                gattc_if == client->getGattcIf() && param->notify.conn_id == client->getConnId())
+                onNotify(target, nullptr, param->notify.value, param->notify.value_len, param->notify.is_notify);
+        }
+        break;
+    }
+    case ESP_GATTC_CONNECT_EVT:
+        openLink(param);
+        break;
+    case ESP_GATTC_CFG_MTU_EVT:
+        if (param->cfg_mtu.status == ESP_GATT_OK)
+            setLinkMtu(param->cfg_mtu.conn_id, param->cfg_mtu.mtu);
+        break;
+    case ESP_GATTC_CONGEST_EVT:
+        if (bulkWrite.client == nullptr || param->congest.conn_id != bulkWrite.client->getConnId())
+            break;
+        bulkWrite.congested = param->congest.congested;
+        if (!param->congest.congested && bulkWrite.uncongested != nullptr)
+            xSemaphoreGive(bulkWrite.uncongested);
+        break;
+    case ESP_GATTC_DISCONNECT_EVT:
+        closeLink(param->disconnect.conn_id);
+        if (gattRequest.pending && gattc_if == gattRequest.gattcIf && param->disconnect.conn_id == gattRequest.connId)
+        {
+            gattRequest.status = ESP_GATT_ERROR;
+            gattRequest.pending = false;
+            xSemaphoreGive(gattRequest.done);
+        }
+        bulkWrite.congested = false;
+        if (bulkWrite.uncongested != nullptr)
+            xSemaphoreGive(bulkWrite.uncongested);
+        break;
+    default:
+        break;
+    }
+}
+
+static uint8_t getProperties(BLERemoteCharacteristic *characteristic)
+{
+    return (characteristic->canBroadcast() ? ESP_GATT_CHAR_PROP_BIT_BROADCAST : 0) |
+           (characteristic->canRead() ? ESP_GATT_CHAR_PROP_BIT_READ : 0) |
+           (characteristic->canWriteNoResponse() ? ESP_GATT_CHAR_PROP_BIT_WRITE_NR : 0) |
+           (characteristic->canWrite() ? ESP_GATT_CHAR_PROP_BIT_WRITE : 0) |
+           (characteristic->canNotify() ? ESP_GATT_CHAR_PROP_BIT_NOTIFY : 0) |
+           (characteristic->canIndicate() ? ESP_GATT_CHAR_PROP_BIT_INDICATE : 0);
+}
+
+// the characteristic value and each of its descriptors
+static void indexCharacteristic(LEAttributeIndex &index, const LEUUIDKey &service, BLERemoteCharacteristic *characteristic)
+{
+    LEAttributeIndex::Entry entry;
+    entry.service = service;
+    entry.characteristic = LEUUIDKey::fromBLEUUID(characteristic->getUUID());
+    entry.descriptor = LEAttributeIndex::none();
+    entry.handle = characteristic->getHandle();
+    entry.properties = getProperties(characteristic);
+    entry.remoteCharacteristic = characteristic;
+    entry.remoteDescriptor = nullptr;
+    index.add(entry);
+
+    for (const auto &descriptorEntry : *characteristic->getDescriptors())
+    {
+        BLERemoteDescriptor *descriptor = descriptorEntry.second;
+        entry.descriptor = LEUUIDKey::fromBLEUUID(descriptor->getUUID());
+        entry.handle = descriptor->getHandle();
+        entry.properties = 0;
+        entry.remoteDescriptor = descriptor;
+        index.add(entry);
+    }
+}
+
+static LEServices collectServices(BLEClient *client)
+{
+    LEServices services;
+    for (const auto &entry : *client->getServices())
+    {
+        BLERemoteService *service = entry.second;
+        services.set(service);
+    }
+    return services;
+}
+
+static void armConnectWatchdog(uint32_t timeout_ms)
+{
+    esp_timer_stop(connectWatchdog);
+    if (timeout_ms > 0)
+        esp_timer_start_once(connectWatchdog, (uint64_t)timeout_ms * 1000);
+}
 
 void LEClient::discover()
 {
     if (_debug)
         Serial.println("\nDiscover Services and Characteristics.\n");
 
+    // a reconnect replaces every remote attribute
+    LEServicesVector.clear();
+    LECharacteristicsVector.clear();
+    LEDescriptorVector.clear();
+    _index.clear();
+
     int serviceIndex = 0;
     int characteristicIndex = 0;
     int descriptorIndex = 0;
@@ -23,6 +681,7 @@ void LEClient::discover()
     {
         BLERemoteService *pService = serverEntry.second;
         LEServicesVector.push_back(pService);
+        LEUUIDKey serviceUUID = LEUUIDKey::fromBLEUUID(pService->getUUID());
         if (_debug)
         {
             String characteristicSizeStr = String(pService->getCharacteristics()->size());
@@ -39,6 +698,7 @@ void LEClient::discover()
         {
             BLERemoteCharacteristic *characteristic = characteristicEntry.second;
             LECharacteristicsVector.push_back(characteristic);
+            indexCharacteristic(_index, serviceUUID, characteristic);
             if (_debug)
             {
                 String descriptorSizeStr = String(characteristic->getDescriptors()->size());
@@ -95,9 +755,8 @@ void LEClient::discover()
                     Serial.print("WNR");
                     slashFlag = true;
                 }
-                Serial.print(")");
+                Serial.println(")");
             }
-            Serial.println();
             characteristicIndex++;
 
             for (const auto &descriptorEntry : *characteristic->getDescriptors())
@@ -123,57 +782,99 @@ void LEClient::setDebug(bool debug)
     _debug = debug;
     advertisedDeviceCallbacks._debug = debug;
     clientCallbacks._debug = debug;
+    for (size_t i = 0; i < LE_MAX_SESSIONS; i++)
+    {
+        _sessions[i]._debug = debug;
+        _sessions[i]._callbacks._debug = debug;
+    }
 
     Serial.setDebugOutput(false);
 }
 
-void LEClient::setOnConnectCallback(void (*callback)())
+void LEClient::setOnConnectCallback(LEEventCallback callback)
 {
     clientCallbacks.setOnConnectCallback(callback);
 }
 
-void LEClient::setOnDisconnectCallback(void (*callback)())
+void LEClient::setOnDisconnectCallback(LEEventCallback callback)
 {
     clientCallbacks.setOnDisconnectCallback(callback);
 }
 
+void LEClient::setOnConnectFunction(const LEEventFunction &callback)
+{
+    clientCallbacks.setOnConnectFunction(callback);
+}
+
+void LEClient::setOnDisconnectFunction(const LEEventFunction &callback)
+{
+    clientCallbacks.setOnDisconnectFunction(callback);
+}
+
+bool LEClient::setDispatchMode(LEDispatchMode mode, LEDropPolicy policy, int core, uint8_t priority)
+{
+    return clientEvents.setMode(mode, policy, core, priority);
+}
+
+uint32_t LEClient::poll()
+{
+    return clientEvents.poll();
+}
+
+LEQueueStats LEClient::getQueueStats()
+{
+    return clientEvents.getStats();
+}
+
 void LEClient::begin()
 {
+    clientEvents.setHandler(deliverClientEvent, nullptr);
+    clientEvents.setReleaser(releaseClientEvent);
+    clientCallbacks._dispatcher = &clientEvents;
+    clientCallbacks._client = this;
+
     BLEDevice::init("LEClient");
     pBLEScan = BLEDevice::getScan();
-    pBLEScan->setAdvertisedDeviceCallbacks(&advertisedDeviceCallbacks);
+    // every advertisement reaches onResult and the store, the library keeps no result list of its own
+    pBLEScan->setAdvertisedDeviceCallbacks(&advertisedDeviceCallbacks, true);
     pBLEScan->setActiveScan(true);
     pClient = BLEDevice::createClient();
 
     pClient->setClientCallbacks(&clientCallbacks);
+
+    if (gattRequest.lock == nullptr)
+    {
+        gattRequest.lock = xSemaphoreCreateMutex();
+        gattRequest.done = xSemaphoreCreateBinary();
+    }
+    LEGattcHandlers::add(handleGattcEvent);
+    LEGapHandlers::add(handleGapEvent);
 }
 
 bool LEClient::connect(const char *server_name, const uint8_t scan_duration)
 {
-    pServer_name = server_name;
-
+    // the previous address stays the reconnect target until the scan finds a new one
     if (_debug)
         Serial.println("\nScanning begins.");
 
-    pBLEScan->start(scan_duration);
+    bool found = scanForName(server_name, scan_duration);
 
     if (_debug)
         Serial.println("Scanning ends.");
 
-    pBLEScan->clearResults();
-
-    if (pServerAddress == nullptr)
+    if (!found)
     {
         Serial.println("Device not found.");
         return false;
     }
     else
     {
+        setServerAddress(*scannedAddress);
         if (_debug)
         {
             Serial.println("\nServer found.");
             Serial.print("Server Name: ");
-            Serial.println(pServer_name);
+            Serial.println(server_name);
             Serial.print("Server Address: ");
             Serial.println(pServerAddress->toString().c_str());
             Serial.println("\nConnecting...");
@@ -181,42 +882,432 @@ bool LEClient::connect(const char *server_name, const uint8_t scan_duration)
 
         pClient->connect(*pServerAddress);
 
-        pServer_name = nullptr; // clear the name to allow scan to work.
-
         if (pClient->isConnected())
         {
             if (_debug)
-            {
                 Serial.println("Successfully Connected.");
-                discover();
-            }
+            _indexed = false;
+            if (_debug)
+                ensureIndex(); // lists the attributes
             return true;
         }
         else
         {
             if (_debug)
-            {
                 Serial.println("Couldn't Connect.");
-                Serial.println("Rebooting...");
-            }
-            esp_restart();          
+
             return false;
         }
     }
 }
 
-bool LEClient::connect(LEAddress server_address)
+bool LEClient::connectAsync(const char *server_name, LEConnectOptions options, LEConnectCallback progress)
 {
-    pServerAddress = server_address.get();
-    pClient->connect(*pServerAddress);
+    if (server_name == nullptr || strlen(server_name) >= sizeof(_connectName) || isConnecting(connectState) || !startConnectTask())
+        return false;
 
-    if (pClient->isConnected())
+    strcpy(_connectName, server_name);
+    _connectOptions = options;
+    connectCallback = progress;
+    _connectCancel = false;
+    _reconnecting = false;
+    connectState = LEConnectScanning;
+    xTaskNotifyGive(_connectTask);
+    return true;
+}
+
+bool LEClient::startConnectTask()
+{
+    if (connectWatchdog == nullptr)
     {
+        esp_timer_create_args_t args;
+        memset(&args, 0, sizeof(args));
+        args.callback = onConnectTimeout;
+        args.dispatch_method = ESP_TIMER_TASK;
+        args.name = "LEConnect";
+        if (esp_timer_create(&args, &connectWatchdog) != ESP_OK)
+        {
+            connectWatchdog = nullptr;
+            return false;
+        }
+    }
+    if (_connectTask == nullptr && xTaskCreatePinnedToCore(connectTask, "LEConnect", 4096, this, 1, &_connectTask, 1) != pdPASS)
+    {
+        _connectTask = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool LEClient::setAutoReconnect(bool enabled, LEConnectOptions options, LEConnectCallback progress)
+{
+    if (enabled && !startConnectTask())
+        return false;
+
+    _reconnectOptions = options;
+    _reconnectCallback = progress;
+    AutoReconnectFlag = enabled;
+    if (!enabled && _reconnecting)
+        cancelConnect();
+    return true;
+}
+
+LEReconnectStats LEClient::getReconnectStats()
+{
+    return _reconnectStats;
+}
+
+void LEClient::onLinkLost()
+{
+    // called on the BLE task by ClientCallbacks::onDisconnect
+    bool requested = _disconnecting;
+    _disconnecting = false;
+    if (isConnecting(connectState)) // the connect task dropped the link itself
+        return;
+
+    // only invalidated here, loop() may be reading the index; the next lookup rebuilds it
+    _layoutCached = false;
+    _linkGeneration++;
+    if (requested)
+        return;
+
+    _reconnectStats.linkLosses++;
+    if (!AutoReconnectFlag || pServerAddress == nullptr || _connectTask == nullptr)
+        return;
+
+    _linkLostAt = millis();
+    _connectOptions = _reconnectOptions;
+    connectCallback = _reconnectCallback;
+    _connectCancel = false;
+    _reconnecting = true;
+    connectState = LEConnectConnecting;
+    xTaskNotifyGive(_connectTask);
+}
+
+void LEClient::cancelConnect()
+{
+    if (_connectTask == nullptr || !isConnecting(connectState))
+        return;
+
+    _connectCancel = true;
+    if (connectState == LEConnectScanning)
+        pBLEScan->stop();
+    else if (connectState == LEConnectConnecting || connectState == LEConnectDiscovering)
+        onConnectTimeout(nullptr);
+    xTaskNotifyGive(_connectTask);
+}
+
+LEConnectState LEClient::getConnectState()
+{
+    return connectState;
+}
+
+void LEClient::connectTask(void *client)
+{
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (isConnecting(connectState))
+            ((LEClient *)client)->runConnect();
+    }
+}
+
+void LEClient::runConnect()
+{
+    uint32_t backoff = _connectOptions.backoffMs;
+    uint8_t attempt = 0;
+
+    while (!_connectCancel)
+    {
+        if (attempt < 0xFF)
+            attempt++;
+        if (connectAttempt(attempt))
+        {
+            if (_reconnecting)
+            {
+                uint32_t restored = restoreNotifyTargets(pClient, _layoutCached ? &_layout : nullptr);
+                uint32_t latency = millis() - _linkLostAt;
+                _reconnectStats.reconnects++;
+                _reconnectStats.lastLatencyMs = latency;
+                if (latency > _reconnectStats.maxLatencyMs)
+                    _reconnectStats.maxLatencyMs = latency;
+                _reconnecting = false;
+
+                if (_debug)
+                    Serial.printf("Reconnected after %d ms, %d notify callbacks restored.\n", latency, restored);
+            }
+            setConnectState(LEConnectReady, attempt);
+            return;
+        }
+        if (_connectCancel || (_connectOptions.maxAttempts > 0 && attempt >= _connectOptions.maxAttempts))
+            break;
+
+        // half fixed, half random, so clients that failed together do not retry together
+        uint32_t delay = backoff / 2 + esp_random() % (backoff / 2 + 1);
         if (_debug)
+            Serial.printf("Attempt %d failed, retrying in %d ms.\n", attempt, delay);
+
+        setConnectState(LEConnectBackoff, attempt);
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(delay)); // cancelConnect() wakes it early
+        backoff = backoff > _connectOptions.backoffMaxMs / 2 ? _connectOptions.backoffMaxMs : backoff * 2;
+    }
+
+    if (_reconnecting && !_connectCancel)
+        _reconnectStats.failures++;
+    _reconnecting = false;
+    setConnectState(_connectCancel ? LEConnectIdle : LEConnectFailed, attempt);
+}
+
+bool LEClient::connectAttempt(uint8_t attempt)
+{
+    // a reconnect already knows the address
+    if (!_reconnecting)
+    {
+        setConnectState(LEConnectScanning, attempt);
+
+        if (!scanForName(_connectName, _connectOptions.scanSeconds))
+            return false;
+        setServerAddress(*scannedAddress);
+    }
+
+    if (pServerAddress == nullptr || _connectCancel)
+        return false;
+
+    setConnectState(LEConnectConnecting, attempt);
+    connectTimedOut = false;
+    armConnectWatchdog(_connectOptions.connectTimeoutMs);
+    bool connected = pClient->connect(*pServerAddress) && pClient->isConnected();
+    esp_timer_stop(connectWatchdog);
+
+    if (connected && connectTimedOut)
+    {
+        pClient->disconnect();
+        return false;
+    }
+    if (!connected)
+        return false;
+
+    if (!_connectCancel)
+    {
+        setConnectState(LEConnectDiscovering, attempt);
+        armConnectWatchdog(_connectOptions.discoverTimeoutMs);
+        if (!loadLayout())
+            discoverLayout();
+        esp_timer_stop(connectWatchdog);
+    }
+
+    if (_connectCancel || !pClient->isConnected())
+    {
+        if (pClient->isConnected())
+            pClient->disconnect();
+        return false;
+    }
+
+    if (_debug)
+        Serial.println("Successfully Connected.");
+    _indexed = false; // built by the first lookup, from the layout when it was cached
+    return true;
+}
+
+bool LEClient::loadLayout()
+{
+    _layoutCached = false;
+    if (!_cacheEnabled || !_gattCache.load(*pServerAddress->getNative(), _layout) || _layout.version != _cacheVersion)
+        return false;
+
+    // one read instead of a full discovery, peers without a Database Hash rely on the version
+    uint8_t hash[16];
+    if (readDatabaseHash(_layout, hash))
+        _layoutCached = memcmp(hash, _layout.databaseHash, sizeof(hash)) == 0;
+    else
+        _layoutCached = !_layout.hasDatabaseHash() && pClient->isConnected();
+
+    if (_debug)
+        Serial.println(_layoutCached ? "Attribute layout restored from cache." : "Cached attribute layout is stale.");
+    return _layoutCached;
+}
+
+// the index and the attribute lists are only touched from the caller's task, on first use after each connection
+void LEClient::ensureIndex()
+{
+    if (_indexed && _indexGeneration == _linkGeneration)
+        return;
+
+    uint32_t generation = _linkGeneration;
+    if (isConnecting(connectState) || !pClient->isConnected())
+    {
+        // the remote attributes of the previous link are gone
+        _index.clear();
+        LEServicesVector.clear();
+        LECharacteristicsVector.clear();
+        LEDescriptorVector.clear();
+        return;
+    }
+
+    if (_layoutCached)
+        indexLayout();
+    else
+        discover();
+    _indexGeneration = generation;
+    _indexed = true;
+}
+
+void LEClient::indexLayout()
+{
+    _index.clear();
+    _index.reserve(_layout.characteristicCount * 2);
+
+    LEAttributeIndex::Entry entry;
+    entry.remoteCharacteristic = nullptr;
+    entry.remoteDescriptor = nullptr;
+    for (uint8_t i = 0; i < _layout.characteristicCount; i++)
+    {
+        const LEGattCharacteristic &characteristic = _layout.characteristics[i];
+        entry.service = _layout.services[characteristic.service].uuid;
+        entry.characteristic = characteristic.uuid;
+        entry.descriptor = LEAttributeIndex::none();
+        entry.handle = characteristic.handle;
+        entry.properties = characteristic.properties;
+        _index.add(entry);
+
+        if (characteristic.cccdHandle != 0)
         {
-            Serial.println("Successfully Connected.");
-            discover();
+            entry.descriptor = LEUUIDKey::from16(0x2902);
+            entry.handle = characteristic.cccdHandle;
+            entry.properties = 0;
+            _index.add(entry);
         }
+    }
+}
+
+bool LEClient::discoverLayout()
+{
+    _layout.clear();
+    memcpy(_layout.address, *pServerAddress->getNative(), sizeof(_layout.address));
+    _layout.version = _cacheVersion;
+    bool complete = true;
+
+    for (const auto &serviceEntry : *pClient->getServices())
+    {
+        BLERemoteService *service = serviceEntry.second;
+        if (_layout.serviceCount >= LE_GATT_CACHE_SERVICES)
+        {
+            complete = false;
+            break;
+        }
+        LEGattService &serviceLayout = _layout.services[_layout.serviceCount];
+        serviceLayout.uuid = LEUUIDKey::fromBLEUUID(service->getUUID());
+        serviceLayout.startHandle = service->getStartHandle();
+        serviceLayout.endHandle = service->getEndHandle();
+
+        for (const auto &characteristicEntry : *service->getCharacteristics())
+        {
+            BLERemoteCharacteristic *characteristic = characteristicEntry.second;
+            if (_layout.characteristicCount >= LE_GATT_CACHE_CHARACTERISTICS)
+            {
+                complete = false;
+                break;
+            }
+            LEGattCharacteristic &layout = _layout.characteristics[_layout.characteristicCount++];
+            layout.uuid = LEUUIDKey::fromBLEUUID(characteristic->getUUID());
+            layout.handle = characteristic->getHandle();
+            layout.service = _layout.serviceCount;
+            layout.properties = getProperties(characteristic);
+            BLERemoteDescriptor *cccd = characteristic->getDescriptor(BLEUUID((uint16_t)0x2902));
+            layout.cccdHandle = cccd != nullptr ? cccd->getHandle() : 0;
+        }
+        _layout.serviceCount++;
+    }
+
+    if (!pClient->isConnected())
+        return false;
+    if (!readDatabaseHash(_layout, _layout.databaseHash))
+        memset(_layout.databaseHash, 0, sizeof(_layout.databaseHash));
+
+    // a truncated layout is still usable for this link, but never cached
+    if (_cacheEnabled && complete && !_gattCache.store(_layout) && _debug)
+        Serial.println("Couldn't store the attribute layout.");
+    return true;
+}
+
+void LEClient::setDiscoveryCache(bool enabled, uint32_t version)
+{
+    _cacheEnabled = enabled;
+    _cacheVersion = version;
+}
+
+bool LEClient::clearDiscoveryCache()
+{
+    return _gattCache.clear();
+}
+
+bool LEClient::isLayoutCached()
+{
+    return _layoutCached;
+}
+
+const LEGattLayout &LEClient::getLayout()
+{
+    return _layout;
+}
+
+uint16_t LEClient::getHandle(const char *service_uuid, const char *characteristic_uuid)
+{
+    ensureIndex();
+    const LEAttributeIndex::Entry *entry = _index.find(service_uuid, characteristic_uuid);
+    return entry != nullptr ? entry->handle : 0;
+}
+
+uint16_t LEClient::getHandle(const LEUUIDKey &service_uuid, const LEUUIDKey &characteristic_uuid)
+{
+    ensureIndex();
+    const LEAttributeIndex::Entry *entry = _index.find(service_uuid, characteristic_uuid);
+    return entry != nullptr ? entry->handle : 0;
+}
+
+const LEAttributeIndex &LEClient::getAttributeIndex()
+{
+    ensureIndex();
+    return _index;
+}
+
+bool LEClient::readHandle(uint16_t handle, uint8_t *buffer, size_t capacity, size_t *length)
+{
+    return gattRead(pClient, handle, buffer, capacity, length);
+}
+
+bool LEClient::readMultiple(LEReadItem *items, size_t count)
+{
+    return gattReadMultiple(pClient, items, count);
+}
+
+bool LEClient::read(const char *service_uuid, const char *characteristic_uuid, uint8_t *buffer, size_t capacity, size_t *length)
+{
+    return readHandle(getHandle(service_uuid, characteristic_uuid), buffer, capacity, length);
+}
+
+bool LEClient::write(const char *service_uuid, const char *characteristic_uuid, const uint8_t *data, size_t length, bool response)
+{
+    return writeHandle(getHandle(service_uuid, characteristic_uuid), data, length, response);
+}
+
+bool LEClient::writeHandle(uint16_t handle, const uint8_t *data, size_t length, bool response)
+{
+    return gattWrite(pClient, handle, data, length, response);
+}
+
+bool LEClient::connect(LEAddress server_address)
+{
+    pServerAddress = server_address.get();
+    pClient->connect(*pServerAddress);
+
+    if (pClient->isConnected())
+    {
+        if (_debug)
+            Serial.println("Successfully Connected.");
+        _indexed = false;
+        if (_debug)
+            ensureIndex();
         return true;
     }
     else
@@ -229,6 +1320,8 @@ bool LEClient::connect(LEAddress server_address)
 }
 bool LEClient::reconnect()
 {
+    if (pServerAddress == nullptr)
+        return false;
     if (!pClient->isConnected())
     {
         pClient->connect(*pServerAddress);
@@ -236,10 +1329,10 @@ bool LEClient::reconnect()
         if (pClient->isConnected())
         {
             if (_debug)
-            {
                 Serial.println("Successfully Rconnected.");
-                discover();
-            }
+            _indexed = false;
+            if (_debug)
+                ensureIndex();
             return true;
         }
         else
@@ -261,18 +1354,17 @@ bool LEClient::isConnected()
 }
 void LEClient::disconnect()
 {
-    pClient->disconnect();
+    cancelConnect();
+    if (pClient->isConnected())
+    {
+        _disconnecting = true; // not a link loss, no auto-reconnect
+        pClient->disconnect();
+    }
 }
 
 LEServices LEClient::getServices()
 {
-    LEServices services;
-    for (const auto &entry : *pClient->getServices())
-    {
-        BLERemoteService *service = entry.second;
-        services.set(service);
-    }
-    return services;
+    return collectServices(pClient);
 }
 LECharacteristics LEClient::getCharacteristics(const char *service_uuid)
 {
@@ -287,7 +1379,16 @@ LECharacteristics LEClient::getCharacteristics(const char *service_uuid)
 
 LECharacteristic LEClient::getCharacteristic(const char *service_uuid, const char *characteristic_uuid)
 {
+    ensureIndex();
     LECharacteristic characteristic;
+    const LEAttributeIndex::Entry *entry = _index.find(service_uuid, characteristic_uuid);
+    if (entry != nullptr && entry->remoteCharacteristic != nullptr)
+    {
+        characteristic.set(entry->remoteCharacteristic);
+        return characteristic;
+    }
+
+    // not indexed yet, or indexed from a cached layout: let BLEClient discover
     BLERemoteCharacteristic *pCharacteristic = pClient->getService(service_uuid)->getCharacteristic(characteristic_uuid);
     characteristic.set(pCharacteristic);
 
@@ -296,75 +1397,387 @@ LECharacteristic LEClient::getCharacteristic(const char *service_uuid, const cha
 
 LECharacteristic LEClient::getCharacteristicByIndex(uint32_t index)
 {
+    ensureIndex();
     LECharacteristic characteristic;
     characteristic.set(LECharacteristicsVector[index]);
     return characteristic;
 }
 LEDescriptor LEClient::getDescriptorByIndex(uint32_t index)
 {
+    ensureIndex();
     LEDescriptor descriptor;
     descriptor.set(LEDescriptorVector[index]);
     return descriptor;
 }
 LEDescriptor LEClient::getDescriptorIndex(const char *service_uuid, const char *characteristic_uuid,const char *descriptor_uuid)
 {
-   uint16_t Vlength = LEDescriptorVector.size();
+   ensureIndex();
    LEDescriptor descriptor;
-   for (size_t i = 0; i < Vlength; i++)
-   {
-     if(LEDescriptorVector[i]->getUUID().equals(BLEUUID(descriptor_uuid))&&
-        LEDescriptorVector[i]->getRemoteCharacteristic()->getUUID().equals(BLEUUID(characteristic_uuid))&&
-        LEDescriptorVector[i]->getRemoteCharacteristic()->getRemoteService()->getUUID().equals(BLEUUID(service_uuid)))
-     {
-        descriptor.set(LEDescriptorVector[i]);
-     }
-   }
+   const LEAttributeIndex::Entry *entry = _index.find(service_uuid, characteristic_uuid, descriptor_uuid);
+   if (entry != nullptr && entry->remoteDescriptor != nullptr)
+      descriptor.set(entry->remoteDescriptor);
    return descriptor;
-   
 }
 LEScanResults LEClient::scan(const uint8_t scan_duration)
 {
     if (_debug)
         Serial.println("\nScanning begins.\n");
 
-    BLEScanResults scanResult = pBLEScan->start(scan_duration);
+    // the store of a paused background scan is kept, the blocking scan adds to it
+    bool paused = pauseScan();
+    if (!paused)
+    {
+        scanStore.setEvictOldest(false);
+        scanStore.clear();
+    }
+    pBLEScan->start(scan_duration);
+    pBLEScan->clearResults();
 
     if (_debug)
-        Serial.printf("\nScanning ends, %d devices found.\n", scanResult.getCount());
+        Serial.printf("\nScanning ends, %d devices found.\n", scanStore.count());
+
+    resumeScan(paused);
+    return LEScanResults(&scanStore);
+}
+
+LEScanFilter &LEClient::getScanFilter()
+{
+    return advertisedDeviceCallbacks.filter;
+}
+
+bool LEClient::startScan(LEAdvertisementCallback callback, uint32_t report_interval_ms)
+{
+    stopScan();
+    advertisedDeviceCallbacks.advertisementCallback = callback;
+    advertisedDeviceCallbacks._reportInterval = report_interval_ms;
+    scanStore.setEvictOldest(true);
+
+    // duration 0 scans until stopped, the start call returns immediately
+    if (!pBLEScan->start(0, onScanComplete, false))
+    {
+        if (_debug)
+            Serial.println("Couldn't start scanning.");
+        return false;
+    }
+    advertisedDeviceCallbacks._continuous = true;
+
+    if (_debug)
+        Serial.println("\nBackground scanning begins.\n");
+    return true;
+}
+
+void LEClient::stopScan()
+{
+    if (!pauseScan())
+        return;
+    pBLEScan->clearResults();
+
+    if (_debug)
+        Serial.printf("\nBackground scanning ends, %d devices found.\n", scanStore.count());
+}
+
+bool LEClient::isScanning()
+{
+    return advertisedDeviceCallbacks._continuous;
+}
+
+LEScanResults LEClient::getScanResults()
+{
+    return LEScanResults(&scanStore);
+}
+String LEClient::getServerMacAdress()
+{
+    if (pServerAddress == nullptr)
+        return String();
+    return String(pServerAddress->toString().c_str());
+}
+
+bool LEClient::setLinkParams(const LELinkParams &params)
+{
+    if (!params.isValid())
+        return false;
+    if (params.mtu != 0 && esp_ble_gatt_set_local_mtu(params.mtu) != ESP_OK)
+        return false;
+    linkParams = params;
+    return true;
+}
+
+bool LEClient::setLinkProfile(LELinkProfile profile)
+{
+    return setLinkParams(LELinkParams::profile(profile));
+}
+
+bool LEClient::tuneLink(const LELinkParams &params)
+{
+    return requestLink(pClient, params);
+}
+
+bool LEClient::tuneLink(LELinkProfile profile)
+{
+    LELinkParams params = LELinkParams::profile(profile);
+    params.mtu = 0; // already exchanged
+    return requestLink(pClient, params);
+}
+
+bool LEClient::getLinkInfo(LELinkInfo &info)
+{
+    return getLink(pClient, info);
+}
+
+void LEClient::setLinkCallback(LELinkCallback callback)
+{
+    linkCallback = callback;
+}
+
+LESession *LEClient::openSession(LEAddress server_address, esp_ble_addr_type_t type)
+{
+    for (size_t i = 0; i < LE_MAX_SESSIONS; i++)
+    {
+        LESession &session = _sessions[i];
+        if (session._open)
+            continue;
+        if (!session.open(*server_address.get(), type, &clientEvents))
+        {
+            session.close();
+            return nullptr;
+        }
+        if (_debug)
+            Serial.printf("Session %d connected to %s.\n", i, session.getServerMacAdress().c_str());
+        return &session;
+    }
+
+    if (_debug)
+        Serial.println("No free session.");
+    return nullptr;
+}
+
+LESession *LEClient::openSession(const char *server_name, const uint8_t scan_duration)
+{
+    if (getSessionCount() >= LE_MAX_SESSIONS || !scanForName(server_name, scan_duration))
+    {
+        if (_debug)
+            Serial.println("Device not found.");
+        return nullptr;
+    }
+
+    for (size_t i = 0; i < LE_MAX_SESSIONS; i++)
+    {
+        LESession &session = _sessions[i];
+        if (session._open)
+            continue;
+        if (!session.open(*scannedAddress, scannedAddressType, &clientEvents))
+        {
+            session.close();
+            return nullptr;
+        }
+        if (_debug)
+            Serial.printf("Session %d connected to %s.\n", i, server_name);
+        return &session;
+    }
+    return nullptr;
+}
+
+void LEClient::closeSession(LESession *session)
+{
+    if (session != nullptr && session >= _sessions && session < _sessions + LE_MAX_SESSIONS)
+        session->close();
+}
+
+LESession *LEClient::getSession(uint32_t index)
+{
+    return index < LE_MAX_SESSIONS && _sessions[index]._open ? &_sessions[index] : nullptr;
+}
+
+uint32_t LEClient::getSessionCount()
+{
+    uint32_t count = 0;
+    for (size_t i = 0; i < LE_MAX_SESSIONS; i++)
+        count += _sessions[i]._open;
+    return count;
+}
+
+bool LESession::open(BLEAddress address, esp_ble_addr_type_t type, LEClientDispatcher *dispatcher)
+{
+    if (_client == nullptr)
+    {
+        _client = BLEDevice::createClient();
+        _client->setClientCallbacks(&_callbacks);
+    }
+    _callbacks._dispatcher = dispatcher;
+    memcpy(_address, *address.getNative(), sizeof(_address));
+    _addressType = type;
+    _open = true;
+    return reconnect();
+}
 
-    uint32_t scanResultCount = scanResult.getCount();
-    LEScanResults customResults;
+void LESession::close()
+{
+    disconnect();
+    detachNotifyTargets(_client);
+    _index.clear();
+    _callbacks.setOnConnectCallback(nullptr);
+    _callbacks.setOnDisconnectCallback(nullptr);
+    _open = false;
+}
 
-    for (size_t i = 0; i < scanResultCount; i++)
+void LESession::discover()
+{
+    // a reconnect replaces every remote attribute
+    _index.clear();
+    for (const auto &serviceEntry : *_client->getServices())
     {
+        BLERemoteService *service = serviceEntry.second;
+        LEUUIDKey serviceUUID = LEUUIDKey::fromBLEUUID(service->getUUID());
+        for (const auto &characteristicEntry : *service->getCharacteristics())
+            indexCharacteristic(_index, serviceUUID, characteristicEntry.second);
+    }
+
+    if (_debug)
+        Serial.printf("Session indexed %d attributes.\n", _index.count());
+}
+
+bool LESession::isConnected()
+{
+    return _client != nullptr && _client->isConnected();
+}
 
-        std::string name = scanResult.getDevice(i).getName().c_str();
-        if (name == "")
-            name = "N/A";
+void LESession::disconnect()
+{
+    if (isConnected())
+        _client->disconnect();
+}
 
-        std::string address = scanResult.getDevice(i).getAddress().toString().c_str();
-        int rssi = scanResult.getDevice(i).getRSSI();
+bool LESession::reconnect()
+{
+    if (!_open || isConnected())
+        return false;
 
-        customResults.set(name, address, rssi, i);
+    _client->connect(BLEAddress(_address), _addressType);
+    if (!_client->isConnected())
+    {
+        if (_debug)
+            Serial.println("Couldn't Connect.");
+        return false;
     }
+    discover();
+    restoreNotifyTargets(_client, nullptr);
+    return true;
+}
+
+uint16_t LESession::getConnId()
+{
+    return isConnected() ? _client->getConnId() : 0;
+}
+
+String LESession::getServerMacAdress()
+{
+    return String(BLEAddress(_address).toString().c_str());
+}
+
+LEServices LESession::getServices()
+{
+    if (_client == nullptr)
+        return LEServices();
+    return collectServices(_client);
+}
+
+LECharacteristic LESession::getCharacteristic(const char *service_uuid, const char *characteristic_uuid)
+{
+    LECharacteristic characteristic;
+    const LEAttributeIndex::Entry *entry = _index.find(service_uuid, characteristic_uuid);
+    if (entry != nullptr)
+        characteristic.set(entry->remoteCharacteristic);
+    return characteristic;
+}
 
-    return customResults;
+LEDescriptor LESession::getDescriptor(const char *service_uuid, const char *characteristic_uuid, const char *descriptor_uuid)
+{
+    LEDescriptor descriptor;
+    const LEAttributeIndex::Entry *entry = _index.find(service_uuid, characteristic_uuid, descriptor_uuid);
+    if (entry != nullptr)
+        descriptor.set(entry->remoteDescriptor);
+    return descriptor;
+}
+
+uint16_t LESession::getHandle(const char *service_uuid, const char *characteristic_uuid)
+{
+    const LEAttributeIndex::Entry *entry = _index.find(service_uuid, characteristic_uuid);
+    return entry != nullptr ? entry->handle : 0;
+}
+
+bool LESession::readHandle(uint16_t handle, uint8_t *buffer, size_t capacity, size_t *length)
+{
+    return gattRead(_client, handle, buffer, capacity, length);
+}
+
+bool LESession::writeHandle(uint16_t handle, const uint8_t *data, size_t length, bool response)
+{
+    return gattWrite(_client, handle, data, length, response);
 }
-const char *LEClient::getServerMacAdress()
+
+bool LESession::tuneLink(const LELinkParams &params)
+{
+    return requestLink(_client, params);
+}
+
+bool LESession::tuneLink(LELinkProfile profile)
 {
-    return pServerAddress->toString().c_str();
+    LELinkParams params = LELinkParams::profile(profile);
+    params.mtu = 0; // already exchanged
+    return requestLink(_client, params);
+}
+
+bool LESession::getLinkInfo(LELinkInfo &info)
+{
+    return getLink(_client, info);
+}
+
+bool LESession::readMultiple(LEReadItem *items, size_t count)
+{
+    return gattReadMultiple(_client, items, count);
+}
+
+bool LESession::read(const char *service_uuid, const char *characteristic_uuid, uint8_t *buffer, size_t capacity, size_t *length)
+{
+    return readHandle(getHandle(service_uuid, characteristic_uuid), buffer, capacity, length);
+}
+
+bool LESession::write(const char *service_uuid, const char *characteristic_uuid, const uint8_t *data, size_t length, bool response)
+{
+    return writeHandle(getHandle(service_uuid, characteristic_uuid), data, length, response);
 }
 void AdvertisedDeviceCallbacks::onResult(BLEAdvertisedDevice advertisedDevice)
 {
-    if (pServer_name != nullptr)
+    if (pServer_name != nullptr && advertisedDevice.getName() == pServer_name)
+    {                                                                   // Check if the name of the advertiser matches
+        advertisedDevice.getScan()->stop();                             // Scan can be stopped, we found what we are looking for
+        if (scannedAddress == nullptr)
+            scannedAddress = new BLEAddress(advertisedDevice.getAddress());
+        else
+            *scannedAddress = advertisedDevice.getAddress();
+        scannedAddressType = advertisedDevice.getAddressType();         // Address of advertiser is the one we need
+        serverFound = true;
+    }
+
+    if (!filter.matches(advertisedDevice))
+        return;
+
+    const uint8_t *address = *advertisedDevice.getAddress().getNative();
+    bool recorded;
+    if (advertisedDevice.haveName())
     {
-        if (advertisedDevice.getName() == pServer_name)
-        {                                                                   // Check if the name of the advertiser matches
-            advertisedDevice.getScan()->stop();                             // Scan can be stopped, we found what we are looking for
-            pServerAddress = new BLEAddress(advertisedDevice.getAddress()); // Address of advertiser is the one we need
-        }
+        std::string name = advertisedDevice.getName();
+        recorded = scanStore.record(address, advertisedDevice.getAddressType(), advertisedDevice.getRSSI(), name.c_str(), name.length());
     }
     else
+    {
+        recorded = scanStore.record(address, advertisedDevice.getAddressType(), advertisedDevice.getRSSI(), nullptr, 0);
+    }
+
+    if (_continuous && recorded && advertisementCallback)
+        report(address);
+
+    if (pServer_name == nullptr)
     {
         if (_debug)
         {
@@ -379,33 +1792,507 @@ void AdvertisedDeviceCallbacks::onResult(BLEAdvertisedDevice advertisedDevice)
     }
 }
 
-void ClientCallbacks::onConnect(BLEClient *_pClient)
+void AdvertisedDeviceCallbacks::report(const uint8_t *address)
 {
+    LEAdvertisement advertisement;
+    if (!scanStore.claimReport(address, _reportInterval, advertisement.device, advertisement.name, sizeof(advertisement.name)))
+        return;
+    memcpy(advertisement.address, advertisement.device.address, sizeof(advertisement.address));
+    advertisement.addressType = advertisement.device.addressType;
+    advertisement.rssi = advertisement.device.rssi;
+
+    if (!clientEvents.isDeferred())
+    {
+        advertisementCallback(advertisement);
+        return;
+    }
+
+    LEClientEvent event;
+    static_assert(sizeof(LEAdvertisement) <= sizeof(event.data), "LEAdvertisement must fit in LE_EVENT_DATA_SIZE");
+    event.type = LEClientEvent::Advertisement;
+    event.target = this;
+    event.length = sizeof(advertisement);
+    memcpy(event.data, &advertisement, sizeof(advertisement));
+    clientEvents.post(event);
+}
 
-    if (onConnectCallback != nullptr)
+void ClientCallbacks::deliver(LEClientEvent::Type type)
+{
+    const LEEventCallback &callback = type == LEClientEvent::Connect ? onConnectCallback : onDisconnectCallback;
+    if (callback)
     {
-        onConnectCallback();
+        callback();
     }
 }
 
+void ClientCallbacks::dispatch(LEClientEvent::Type type)
+{
+    if (_dispatcher != nullptr && _dispatcher->isDeferred())
+    {
+        LEClientEvent event;
+        event.type = type;
+        event.target = this;
+        event.length = 0;
+        _dispatcher->post(event);
+    }
+    else
+    {
+        deliver(type);
+    }
+}
+
+void ClientCallbacks::onConnect(BLEClient *_pClient)
+{
+    dispatch(LEClientEvent::Connect);
+}
+
 void ClientCallbacks::onDisconnect(BLEClient *_pClient)
 {
     if (_debug)
         Serial.println("Disconnected.");
 
-    if (onDisconnectCallback != nullptr)
+    if (_client != nullptr)
+    {
+        if (connectState == LEConnectReady)
+            connectState = LEConnectIdle;
+        _client->onLinkLost();
+    }
+    dispatch(LEClientEvent::Disconnect);
+}
+
+static LENotifyTarget *getNotifyTarget(BLERemoteCharacteristic *pCharacteristic, bool create)
+{
+    BLEClient *client = getOwner(pCharacteristic);
+    BLEUUID service = pCharacteristic->getRemoteService()->getUUID();
+    BLEUUID uuid = pCharacteristic->getUUID();
+    size_t count = notifyTargetCount.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < count; i++)
+    {
+        LENotifyTarget *target = notifyTargets[i];
+        // by identity, not by pointer: a freed characteristic's address is reused after a reconnect,
+        // and sessions may share UUIDs
+        if (target->client == client && target->uuid.equals(uuid) && target->service.equals(service))
+        {
+            target->characteristic = pCharacteristic;
+            target->handle = 0;
+            return target;
+        }
+    }
+    if (!create)
+        return nullptr;
+
+    // a target detached by a closed session is taken over, unless it holds a stream or ring
+    // a queued event or an old LECharacteristic may still point at
+    for (size_t i = 0; i < count; i++)
+    {
+        LENotifyTarget *target = notifyTargets[i];
+        if (target->client != nullptr || target->stream != nullptr || target->ring != nullptr)
+            continue;
+        target->characteristic = pCharacteristic;
+        target->service = service;
+        target->uuid = uuid;
+        target->handle = 0;
+        target->callback = nullptr;
+        target->streamCallback = nullptr;
+        target->function = nullptr;
+        target->streamFunction = nullptr;
+        target->client = client;
+        return target;
+    }
+    if (count == LE_MAX_NOTIFY_TARGETS)
+        return nullptr;
+
+    LENotifyTarget *target = new (std::nothrow) LENotifyTarget;
+    if (target == nullptr)
+        return nullptr;
+    target->client = client;
+    target->characteristic = pCharacteristic;
+    target->service = service;
+    target->uuid = uuid;
+    target->handle = 0;
+    target->stream = nullptr;
+    target->ring = nullptr;
+    notifyTargets[count] = target;
+    notifyTargetCount.store(count + 1, std::memory_order_release);
+    return target;
+}
+
+// a closed session's BLEClient is reused for the next peer, its targets must not be restored there
+static void detachNotifyTargets(BLEClient *client)
+{
+    size_t count = notifyTargetCount.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < count; i++)
+    {
+        LENotifyTarget *target = notifyTargets[i];
+        if (target->client != client)
+            continue;
+        target->client = nullptr;
+        target->handle = 0;
+        target->characteristic = nullptr;
+        if (target->stream != nullptr)
+            target->stream->reset();
+    }
+}
+
+static void onNotify(LENotifyTarget *target, BLERemoteCharacteristic *pCharacteristic, uint8_t *pData, size_t length, bool isNotify)
+{
+    if (target->ring != nullptr)
+        target->ring->push(pData, length, esp_timer_get_time());
+    if (target->stream == nullptr && !target->callback)
+        return; // buffered only, nothing to queue
+
+    LEClientEvent event;
+    event.target = target;
+    event.characteristic = pCharacteristic;
+    event.isNotify = isNotify;
+
+    if (target->stream != nullptr)
     {
-        onDisconnectCallback();
+        // fragments are reassembled here, before any copy could truncate them
+        if (!target->stream->feed(pData, length))
+            return;
+        if (!clientEvents.isDeferred())
+        {
+            if (target->streamCallback)
+                target->streamCallback(target->stream->data(), target->stream->length());
+            target->stream->release();
+            return;
+        }
+        event.type = LEClientEvent::Stream;
+        event.length = 0;
+        if (!clientEvents.post(event))
+            target->stream->release();
+        return;
+    }
+
+    if (!clientEvents.isDeferred())
+    {
+        if (target->callback)
+            target->callback(pCharacteristic, pData, length, isNotify);
+        return;
+    }
+
+    event.type = LEClientEvent::Notify;
+    event.length = length;
+    if (length > sizeof(event.data))
+    {
+        event.length = sizeof(event.data);
+        clientEvents.noteTruncated();
+    }
+    memcpy(event.data, pData, event.length);
+    clientEvents.post(event);
+}
+
+static void registerNotifyTarget(LENotifyTarget *target)
+{
+    target->characteristic->registerForNotify([target](BLERemoteCharacteristic *pCharacteristic, uint8_t *pData, size_t length, bool isNotify)
+    {
+        onNotify(target, pCharacteristic, pData, length, isNotify);
+    });
+}
+
+void LECharacteristic::setNotifyCallback(LENotifyCallback notifyCallback)
+{
+    LENotifyTarget *target = getNotifyTarget(_pCharacteristic, (bool)notifyCallback);
+
+    if (!notifyCallback)
+    {
+        if (target != nullptr)
+            target->callback = nullptr;
+        if (target == nullptr || (target->stream == nullptr && target->ring == nullptr))
+            _pCharacteristic->registerForNotify(nullptr);
+        return;
+    }
+
+    if (target == nullptr)
+        return;
+    target->callback = notifyCallback;
+    registerNotifyTarget(target);
+}
+
+// notify targets are never freed, the delegate may point at the stored function
+void LECharacteristic::setNotifyFunction(const LENotifyFunction &notifyCallback)
+{
+    if (!notifyCallback)
+    {
+        setNotifyCallback(nullptr);
+        return;
+    }
+    LENotifyTarget *target = getNotifyTarget(_pCharacteristic, true);
+    if (target == nullptr)
+        return;
+    target->function = notifyCallback;
+    LENotifyFunction *function = &target->function;
+    setNotifyCallback([function](BLERemoteCharacteristic *characteristic, uint8_t *data, size_t length, bool isNotify)
+                      { (*function)(characteristic, data, length, isNotify); });
+}
+
+bool LECharacteristic::setStreamFunction(size_t max_length, const LEStreamFunction &streamCallback)
+{
+    if (!streamCallback)
+        return setStreamCallback(max_length, nullptr);
+    LENotifyTarget *target = getNotifyTarget(_pCharacteristic, true);
+    if (target == nullptr)
+        return false;
+    target->streamFunction = streamCallback;
+    LEStreamFunction *function = &target->streamFunction;
+    return setStreamCallback(max_length, [function](uint8_t *data, size_t length) { (*function)(data, length); });
+}
+
+bool LECharacteristic::setStreamCallback(size_t max_length, LEStreamCallback streamCallback)
+{
+    LENotifyTarget *target = getNotifyTarget(_pCharacteristic, true);
+    if (target == nullptr)
+        return false;
+
+    if (target->stream == nullptr)
+        target->stream = new (std::nothrow) LEStreamReassembler;
+    if (target->stream == nullptr || !target->stream->begin(max_length))
+        return false;
+
+    target->streamCallback = streamCallback;
+    registerNotifyTarget(target);
+    return true;
+}
+
+bool LECharacteristic::setNotifyBuffer(size_t slots)
+{
+    if (_pCharacteristic == nullptr)
+        return false;
+
+    LENotifyTarget *target = getNotifyTarget(_pCharacteristic, true);
+    if (target == nullptr)
+        return false;
+    if (target->ring == nullptr)
+        target->ring = new (std::nothrow) LENotifyRing;
+    if (target->ring == nullptr || !target->ring->begin(slots))
+        return false;
+
+    _ring = target->ring;
+    registerNotifyTarget(target);
+    return true;
+}
+
+LENotifyRing *LECharacteristic::getRing()
+{
+    // looked up once per LECharacteristic, pop() runs every loop()
+    if (_ring == nullptr && _pCharacteristic != nullptr)
+    {
+        LENotifyTarget *target = getNotifyTarget(_pCharacteristic, false);
+        if (target != nullptr)
+            _ring = target->ring;
     }
+    return _ring;
+}
+
+size_t LECharacteristic::available()
+{
+    LENotifyRing *ring = getRing();
+    return ring != nullptr ? ring->available() : 0;
+}
+
+bool LECharacteristic::pop(LENotification &notification)
+{
+    LENotifyRing *ring = getRing();
+    return ring != nullptr && ring->pop(notification);
+}
+
+size_t LECharacteristic::pop(LENotification *notifications, size_t count)
+{
+    LENotifyRing *ring = getRing();
+    return ring != nullptr ? ring->pop(notifications, count) : 0;
+}
+
+LENotifyStats LECharacteristic::getNotifyStats()
+{
+    LENotifyRing *ring = getRing();
+    if (ring == nullptr)
+    {
+        LENotifyStats stats = {0, 0, 0, 0};
+        return stats;
+    }
+    return ring->getStats();
+}
+
+static bool waitForBuffers(uint16_t connId)
+{
+    // the stack reports congestion once its queue for the link is full, the controller
+    // count covers the buffers between two connection events
+    uint32_t start = millis();
+    while (bulkWrite.congested || esp_ble_get_cur_sendable_packets_num(connId) == 0)
+    {
+        if (!bulkWrite.client->isConnected() || millis() - start > LE_GATT_TIMEOUT_MS)
+            return false;
+        if (bulkWrite.congested)
+            xSemaphoreTake(bulkWrite.uncongested, pdMS_TO_TICKS(10));
+        else
+            vTaskDelay(1);
+    }
+    return true;
+}
+
+static void runBulkWrite()
+{
+    LEWriteStats &stats = bulkWrite.stats;
+    memset(&stats, 0, sizeof(stats));
+    uint32_t start = millis();
+
+    BLEClient *client = bulkWrite.client;
+    uint16_t connId = client->getConnId();
+    size_t chunk = client->getMTU() > 3 ? client->getMTU() - 3 : 20;
+    size_t offset = 0;
+    while (offset < bulkWrite.length)
+    {
+        if (!client->isConnected())
+            break;
+        if (bulkWrite.congested || esp_ble_get_cur_sendable_packets_num(connId) == 0)
+        {
+            stats.congestionWaits++;
+            if (!waitForBuffers(connId))
+                break;
+        }
+
+        size_t length = bulkWrite.length - offset < chunk ? bulkWrite.length - offset : chunk;
+        if (esp_ble_gattc_write_char(client->getGattcIf(), connId, bulkWrite.handle, length, (uint8_t *)bulkWrite.data + offset,
+                                     ESP_GATT_WRITE_TYPE_NO_RSP, ESP_GATT_AUTH_REQ_NONE) != ESP_OK)
+        {
+            // the stack's own queue is full, give it a connection event
+            stats.congestionWaits++;
+            vTaskDelay(1);
+            if (!waitForBuffers(connId))
+                break;
+            continue;
+        }
+        offset += length;
+        stats.chunks++;
+    }
+
+    stats.bytes = offset;
+    stats.elapsedMs = millis() - start;
+    stats.bytesPerSecond = stats.elapsedMs > 0 ? (uint64_t)offset * 1000 / stats.elapsedMs : offset;
+    stats.completed = offset == bulkWrite.length;
+}
+
+static void bulkWriteTask(void *arg)
+{
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        runBulkWrite();
+
+        LEWriteStats stats = bulkWrite.stats;
+        if (!bulkWrite.callback)
+        {
+            bulkWrite.busy = false;
+            continue;
+        }
+        if (!clientEvents.isDeferred())
+        {
+            bulkWrite.callback(stats);
+            bulkWrite.busy = false;
+            continue;
+        }
+
+        LEClientEvent event;
+        static_assert(sizeof(LEWriteStats) <= sizeof(event.data), "LEWriteStats must fit in LE_EVENT_DATA_SIZE");
+        event.type = LEClientEvent::WriteComplete;
+        event.target = nullptr;
+        event.length = sizeof(stats);
+        memcpy(event.data, &stats, sizeof(stats));
+        if (!clientEvents.post(event))
+        {
+            bulkWrite.callback(stats);
+            bulkWrite.busy = false;
+        }
+    }
+}
+
+bool LECharacteristic::writeBulk(const uint8_t *data, size_t length, LEWriteCallback callback)
+{
+    if (_pCharacteristic == nullptr || bulkWrite.busy || !getOwner(_pCharacteristic)->isConnected())
+        return false;
+
+    if (bulkWrite.task == nullptr)
+    {
+        bulkWrite.uncongested = xSemaphoreCreateBinary();
+        if (xTaskCreatePinnedToCore(bulkWriteTask, "LEWrite", 3072, nullptr, 2, &bulkWrite.task, 1) != pdPASS)
+        {
+            bulkWrite.task = nullptr;
+            return false;
+        }
+    }
+
+    bulkWrite.busy = true;
+    bulkWrite.congested = false; // a congestion flag left by another connection
+    bulkWrite.client = getOwner(_pCharacteristic);
+    bulkWrite.handle = _pCharacteristic->getHandle();
+    bulkWrite.data = data;
+    bulkWrite.length = length;
+    bulkWrite.callback = callback;
+    xTaskNotifyGive(bulkWrite.task);
+    return true;
+}
+
+bool LEClient::isWriting()
+{
+    return bulkWrite.busy;
+}
+
+LEWriteStats LEClient::getWriteStats()
+{
+    return bulkWrite.stats;
+}
+
+size_t LECharacteristic::read(uint8_t *buffer, size_t capacity)
+{
+    size_t length = 0;
+    if (_pCharacteristic == nullptr)
+        return 0;
+    BLEClient *client = getOwner(_pCharacteristic);
+    if (!beginRequest(client, ESP_GATTC_READ_CHAR_EVT, _pCharacteristic->getHandle(), buffer, capacity))
+        return 0;
+    finishRequest(esp_ble_gattc_read_char(client->getGattcIf(), client->getConnId(), _pCharacteristic->getHandle(), ESP_GATT_AUTH_REQ_NONE), &length);
+    return length;
+}
+
+size_t LEDescriptor::read(uint8_t *buffer, size_t capacity)
+{
+    size_t length = 0;
+    if (_pDescriptor == nullptr)
+        return 0;
+    BLEClient *client = getOwner(_pDescriptor->getRemoteCharacteristic());
+    if (!beginRequest(client, ESP_GATTC_READ_DESCR_EVT, _pDescriptor->getHandle(), buffer, capacity))
+        return 0;
+    finishRequest(esp_ble_gattc_read_char_descr(client->getGattcIf(), client->getConnId(), _pDescriptor->getHandle(), ESP_GATT_AUTH_REQ_NONE), &length);
+    return length;
+}
+
+LEStreamStats LECharacteristic::getStreamStats()
+{
+    LENotifyTarget *target = getNotifyTarget(_pCharacteristic, false);
+    if (target == nullptr || target->stream == nullptr)
+    {
+        LEStreamStats stats = {0, 0, 0};
+        return stats;
+    }
+    return target->stream->getStats();
 }
 
 LECharacteristics LEServices::getCharacteristics(const char *service_uuid)
 {
+    // from the services collected here, whichever connection they belong to
     LECharacteristics characteristics;
-    for (const auto &entry : *pClient->getService(service_uuid)->getCharacteristics())
+    BLEUUID uuid(service_uuid);
+    for (size_t i = 0; i < LEServicesVector.size(); i++)
     {
-        BLERemoteCharacteristic *characteristic = entry.second;
-        characteristics.set(characteristic);
+        if (!LEServicesVector[i]->getUUID().equals(uuid))
+            continue;
+        for (const auto &entry : *LEServicesVector[i]->getCharacteristics())
+        {
+            BLERemoteCharacteristic *characteristic = entry.second;
+            characteristics.set(characteristic);
+        }
+        break;
     }
     return characteristics;
 }
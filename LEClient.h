@@ -1,7 +1,132 @@
+#ifndef LEClient_H
+#define LEClient_H
+
 #include <Arduino.h>
 #include <BLEDevice.h>
 #include <vector>
+#include <functional>
+#include <LEEventQueue.h>
+#include <LEStream.h>
+#include <LENotifyRing.h>
+#include <LEPacked.h>
+#include <LEDelegate.h>
+#include <LEScanStore.h>
+#include <LEScanFilter.h>
+#include <LEGattCache.h>
+#include <LEAttributeIndex.h>
+#include <LELink.h>
+
+typedef LEDelegate<void(BLERemoteCharacteristic *pBLERemoteCharacteristic, uint8_t *pData, size_t length, bool isNotify)> LENotifyCallback;
+typedef LEDelegate<void(uint8_t *pData, size_t length)> LEStreamCallback;
+// what sketches passed before LEDelegate, still taken by the setters and allocated once per setter call
+typedef std::function<void(BLERemoteCharacteristic *pBLERemoteCharacteristic, uint8_t *pData, size_t length, bool isNotify)> LENotifyFunction;
+typedef std::function<void(uint8_t *pData, size_t length)> LEStreamFunction;
+
+struct LEWriteStats
+{
+  uint32_t bytes;
+  uint32_t chunks;
+  uint32_t congestionWaits; // pauses for a GATT congestion event or full controller buffers
+  uint32_t elapsedMs;
+  uint32_t bytesPerSecond;
+  bool completed;           // false when the link dropped or the stack kept refusing writes
+};
+
+typedef LEDelegate<void(const LEWriteStats &stats)> LEWriteCallback;
+
+/**
+ * @brief One value of LEClient::readMultiple. Read Multiple responses carry no lengths,
+ * so length must be the value's exact size; values of another size are read one by one.
+ */
+struct LEReadItem
+{
+  uint16_t handle;
+  uint8_t *buffer;
+  size_t length;   // expected value length, the size of buffer
+  size_t received; // set by readMultiple, 0 when the read failed
+};
+typedef LEDelegate<void()> LEEventCallback;
+typedef std::function<void()> LEEventFunction;
+
+#ifndef LE_GATT_TIMEOUT_MS
+#define LE_GATT_TIMEOUT_MS 2000 // per handle based request
+#endif
+
+#ifndef LE_CONNECT_NAME_SIZE
+#define LE_CONNECT_NAME_SIZE 32 // server name bytes kept by connectAsync, including the terminator
+#endif
+
+#ifndef LE_MAX_NOTIFY_TARGETS
+#define LE_MAX_NOTIFY_TARGETS 16 // characteristics with a notify callback, stream or buffer, over all connections
+#endif
+
+#ifndef LE_MAX_SESSIONS
+#define LE_MAX_SESSIONS 2 // sessions + 1 (the single-peer connection) must not exceed CONFIG_BTDM_CTRL_BLE_MAX_CONN, 3 by default
+#endif
+
+#if defined(CONFIG_BTDM_CTRL_BLE_MAX_CONN) && LE_MAX_SESSIONS + 1 > CONFIG_BTDM_CTRL_BLE_MAX_CONN
+#error "LE_MAX_SESSIONS + 1 exceeds CONFIG_BTDM_CTRL_BLE_MAX_CONN"
+#endif
+
+/**
+ * @brief Stages of LEClient::connectAsync, reported to the progress callback as they begin.
+ */
+enum LEConnectState : uint8_t
+{
+  LEConnectIdle,
+  LEConnectScanning,
+  LEConnectConnecting,
+  LEConnectDiscovering,
+  LEConnectReady,
+  LEConnectBackoff, // waiting before the next attempt
+  LEConnectFailed,  // maxAttempts reached
+};
+
+struct LEConnectOptions
+{
+  uint8_t scanSeconds = 5;
+  uint32_t connectTimeoutMs = 10000; // an open cannot be cancelled, it may block up to CONFIG_BT_BLE_ESTAB_LINK_CONN_TOUT (30 s) and a late link is dropped
+  uint32_t discoverTimeoutMs = 10000;
+  uint32_t backoffMs = 500;     // first retry delay, doubled per failed attempt
+  uint32_t backoffMaxMs = 30000;
+  uint8_t maxAttempts = 0;      // 0 retries until cancelConnect()
+};
+
+typedef LEDelegate<void(LEConnectState state, uint8_t attempt)> LEConnectCallback;
+
+struct LEReconnectStats
+{
+  uint32_t linkLosses;
+  uint32_t reconnects;
+  uint32_t failures;      // gave up after maxAttempts
+  uint32_t lastLatencyMs; // link loss to notifications restored
+  uint32_t maxLatencyMs;
+};
+
+/**
+ * @brief Copy of a client event queued for deferred delivery.
+ */
+struct LEClientEvent
+{
+  enum Type : uint8_t
+  {
+    Connect,
+    Disconnect,
+    Notify,
+    Stream,
+    Advertisement, // data holds an LEAdvertisement
+    Progress,      // data holds the LEConnectState and the attempt
+    WriteComplete, // data holds the LEWriteStats
+    Link,          // data holds the LELinkInfo
+  } type;
+  void *target;
+  BLERemoteCharacteristic *characteristic;
+  bool isNotify;
+  size_t length;
+  uint8_t data[LE_EVENT_DATA_SIZE];
+};
 
+typedef LEEventDispatcher<LEClientEvent> LEClientDispatcher;
 
 class LEAddress
 {
@@ -14,61 +139,151 @@ public:
   bool equals(const char *address) { return (*_address).equals(BLEAddress(address)); }
 };
 
+/**
+ * @brief View over the client's LEScanStore, every result is a copy taken under the store's lock.
+ */
 class LEScanResults
 {
 private:
   struct LEScanResult
   {
-    const char *name;
-    const char *address;
+    char name[LE_SCAN_NAME_SIZE]; // "N/A" when none was advertised
+    char address[18];
     int rssi;
     uint32_t id;
+    LEScanDevice device; // RSSI statistics
   };
 
-  std::vector<LEScanResult> LEScanResultsVector;
+  LEScanStore *_store;
 
 public:
-  void set(std::string name, std::string address, int rssi, uint32_t id)
-  {
-    LEScanResult result;
+  LEScanResults(LEScanStore *store) : _store(store) {}
 
-    result.name = strdup(name.c_str());       // duplicate for new memory location
-    result.address = strdup(address.c_str()); // duplicate for new memory location
-    result.rssi = rssi;
-    result.id = id;
-
-    LEScanResultsVector.push_back(result);
-  }
   LEScanResult get(uint32_t index)
   {
-    return LEScanResultsVector[index];
+    LEScanResult result;
+    result.id = index;
+    if (!_store->read(index, result.device, result.name, sizeof(result.name)))
+    {
+      memset(&result.device, 0, sizeof(result.device));
+      strcpy(result.name, "N/A");
+      result.address[0] = '\0';
+      result.rssi = 0;
+      return result;
+    }
+    if (result.name[0] == '\0')
+      strcpy(result.name, "N/A");
+    const LEScanDevice &device = result.device;
+    snprintf(result.address, sizeof(result.address), "%02x:%02x:%02x:%02x:%02x:%02x",
+             device.address[0], device.address[1], device.address[2], device.address[3], device.address[4], device.address[5]);
+    result.rssi = device.rssi;
+    return result;
   }
+  size_t top(LEScanDevice *out, size_t k) { return _store->top(out, k); }
+  LEScanStore &getStore() { return *_store; }
   void clear()
   {
-    LEScanResultsVector.clear();
+    _store->clear();
   }
   uint32_t count()
   {
-    return LEScanResultsVector.size();
+    return _store->count();
   }
 };
 
 class LECharacteristic
 {
 private:
-  BLERemoteCharacteristic *_pCharacteristic;
+  BLERemoteCharacteristic *_pCharacteristic = nullptr;
+  LENotifyRing *_ring = nullptr;
+  LENotifyRing *getRing();
 
 public:
-  void set(BLERemoteCharacteristic *characteristic) { _pCharacteristic = characteristic; }
+  void set(BLERemoteCharacteristic *characteristic)
+  {
+    _pCharacteristic = characteristic;
+    _ring = nullptr;
+  }
   BLERemoteCharacteristic *get() { return _pCharacteristic; }
-  const char *read() { return  strdup(_pCharacteristic->readValue().c_str()); }
+  String read() { return String(_pCharacteristic->readValue().c_str()); }
+  /**
+   * @brief Reads the value into buffer, binary safe. BLERemoteCharacteristic still keeps its own copy of the response.
+   * Returns the full value length, which exceeds capacity when the copy was truncated, or 0 when the read failed.
+   */
+  size_t read(uint8_t *buffer, size_t capacity);
   void write(const char *data) { _pCharacteristic->writeValue(data); }
   void write(uint8_t *pData, size_t length){_pCharacteristic->writeValue(pData,length);}
-  const char *getUUID(){return _pCharacteristic->getUUID().toString().c_str();}
-  void setNotifyCallback(std::function<void(BLERemoteCharacteristic *pBLERemoteCharacteristic, uint8_t *pData, size_t length, bool isNotify)> notifyCallback)
+  /**
+   * @brief Streams data with write without response in MTU sized chunks on a writer task and returns at once.
+   * Pacing follows the controller's free buffers and GATT congestion events; data must stay valid until
+   * callback runs (dispatched like the other client events). Returns false while another bulk write runs
+   * or its callback has not run yet.
+   */
+  bool writeBulk(const uint8_t *data, size_t length, LEWriteCallback callback = nullptr);
+  String getUUID() { return String(_pCharacteristic->getUUID().toString().c_str()); }
+  void setNotifyCallback(LENotifyCallback notifyCallback);
+  void setNotifyFunction(const LENotifyFunction &notifyCallback);
+  template <typename F, typename = typename std::enable_if<LENotifyCallback::spills<F>::value>::type>
+  void setNotifyCallback(F &&notifyCallback) { setNotifyFunction(LENotifyFunction(std::forward<F>(notifyCallback))); }
+
+  /**
+   * @brief Reassembles LEServer::stream messages of up to max_length bytes, the buffer is allocated once here.
+   * A later call keeps that buffer and fails when max_length no longer fits in it.
+   */
+  bool setStreamCallback(size_t max_length, LEStreamCallback streamCallback);
+  bool setStreamFunction(size_t max_length, const LEStreamFunction &streamCallback);
+  template <typename F, typename = typename std::enable_if<LEStreamCallback::spills<F>::value>::type>
+  bool setStreamCallback(size_t max_length, F &&streamCallback) { return setStreamFunction(max_length, LEStreamFunction(std::forward<F>(streamCallback))); }
+  LEStreamStats getStreamStats();
+
+  /**
+   * @brief Copies every notification, with its arrival time and sequence number, into a ring of slots entries
+   * for loop() to drain with available() and pop(), next to any notify callback. The ring is allocated once here,
+   * a later call with a different size fails; when it is full the newest notification is dropped and counted as an overrun.
+   */
+  bool setNotifyBuffer(size_t slots);
+  size_t available();
+  bool pop(LENotification &notification);
+  size_t pop(LENotification *notifications, size_t count);
+  LENotifyStats getNotifyStats();
+  /**
+   * @brief Typed access in LEPacked encoding, matching LETypedCharacteristic on the server.
+   * readAs returns false when the value length does not match T.
+   */
+  template <typename T>
+  bool readAs(T &value)
   {
-    _pCharacteristic->registerForNotify(notifyCallback);
-  };
+    uint8_t buffer[sizeof(T)];
+    size_t length = read(buffer, sizeof(buffer));
+    return length == sizeof(T) && LEPacked<T>::decode(buffer, length, value);
+  }
+  template <typename T>
+  void writeAs(const T &value, bool response = false)
+  {
+    uint8_t buffer[sizeof(T)];
+    LEPacked<T>::encode(value, buffer);
+    _pCharacteristic->writeValue(buffer, sizeof(buffer), response);
+  }
+  /**
+   * @brief Notifications whose length does not match T are ignored. With a deferred dispatch mode
+   * T must fit in LE_EVENT_DATA_SIZE.
+   */
+  template <typename T>
+  void setTypedNotifyCallback(void (*callback)(const T &value))
+  {
+    if (callback == nullptr)
+    {
+      setNotifyCallback(nullptr);
+      return;
+    }
+    setNotifyCallback([callback](BLERemoteCharacteristic *pCharacteristic, uint8_t *pData, size_t length, bool isNotify)
+    {
+      T value;
+      if (LEPacked<T>::decode(pData, length, value))
+        callback(value);
+    });
+  }
+
   bool canRead() { return _pCharacteristic->canRead(); }
   bool canWrite() { return _pCharacteristic->canWrite(); }
   bool canNotify() { return _pCharacteristic->canNotify(); }
@@ -89,14 +304,14 @@ public:
     characteristic.set(LECharacteristicsVector[index]);
     return characteristic;
   }
-  const char* getUUID(uint32_t index)
+  String getUUID(uint32_t index)
   {
     if(index < LECharacteristicsVector.size())
-        return strdup(LECharacteristicsVector[index]->getUUID().toString().c_str());
+        return String(LECharacteristicsVector[index]->getUUID().toString().c_str());
     else
     {  
         Serial.println("Characteristics index out of range.");
-        return "";
+        return String();
     }
   }
   void clear()
@@ -121,14 +336,14 @@ public:
   }
   BLERemoteService * get(uint32_t index){return LEServicesVector[index];}
   LECharacteristics getCharacteristics(const char* service_uuid);
-  const char* getUUID(uint32_t index)
+  String getUUID(uint32_t index)
   {
     if(index < LEServicesVector.size())
-      return strdup(LEServicesVector[index]->getUUID().toString().c_str());
+      return String(LEServicesVector[index]->getUUID().toString().c_str());
     else
     {
         Serial.println("Services index out of range.");
-        return "";
+        return String();
     }
   }
   void clear()
@@ -144,34 +359,239 @@ public:
 class LEDescriptor
 {
 private:
-  BLERemoteDescriptor *_pDescriptor;
+  BLERemoteDescriptor *_pDescriptor = nullptr;
 
 public:
   void set(BLERemoteDescriptor *descriptor) { _pDescriptor = descriptor; }
   BLERemoteDescriptor *get() { return _pDescriptor; }
-  const char *read() { return _pDescriptor->readValue().c_str(); }
-  const char *getUUID(){return _pDescriptor->getUUID().toString().c_str();}
+  String read() { return String(_pDescriptor->readValue().c_str()); }
+  /**
+   * @brief Same contract as LECharacteristic::read(buffer, capacity).
+   */
+  size_t read(uint8_t *buffer, size_t capacity);
+  String getUUID() { return String(_pDescriptor->getUUID().toString().c_str()); }
 
 };
 
+class LEClient;
+
+class ClientCallbacks : public BLEClientCallbacks
+{
+public:
+  bool _debug = false;
+  LEClientDispatcher *_dispatcher = nullptr;
+  LEClient *_client = nullptr; // NULL for sessions, they never auto-reconnect
+  void deliver(LEClientEvent::Type type);
+  void setOnDisconnectCallback(LEEventCallback callback)
+  {
+    onDisconnectCallback = callback;
+  }
+  void setOnConnectCallback(LEEventCallback callback)
+  {
+    onConnectCallback = callback;
+  }
+  // the delegate calls the stored function, the object must not move (it is a global or an LESession member)
+  void setOnDisconnectFunction(const LEEventFunction &callback)
+  {
+    onDisconnectFunction = callback;
+    LEEventFunction *function = &onDisconnectFunction;
+    onDisconnectCallback = callback ? LEEventCallback([function]() { (*function)(); }) : LEEventCallback();
+  }
+  void setOnConnectFunction(const LEEventFunction &callback)
+  {
+    onConnectFunction = callback;
+    LEEventFunction *function = &onConnectFunction;
+    onConnectCallback = callback ? LEEventCallback([function]() { (*function)(); }) : LEEventCallback();
+  }
+
+private:
+  LEEventCallback onDisconnectCallback;
+  LEEventCallback onConnectCallback;
+  LEEventFunction onDisconnectFunction;
+  LEEventFunction onConnectFunction;
+  void dispatch(LEClientEvent::Type type);
+  void onConnect(BLEClient *_pClient);
+  void onDisconnect(BLEClient *_pClient);
+};
+
+/**
+ * @brief One more peripheral next to the LEClient single-peer API, opened by LEClient::openSession.
+ * Every session has its own BLEClient, attribute index and connect/disconnect callbacks.
+ */
+class LESession
+{
+private:
+  BLEClient *_client = nullptr; // created on first open and kept with the slot, the stack may still reference it after a close
+  ClientCallbacks _callbacks;
+  LEAttributeIndex _index;
+  uint8_t _address[6];
+  esp_ble_addr_type_t _addressType = BLE_ADDR_TYPE_PUBLIC;
+  bool _open = false;
+  bool _debug = false;
+  bool open(BLEAddress address, esp_ble_addr_type_t type, LEClientDispatcher *dispatcher);
+  void close();
+  void discover();
+  friend class LEClient;
+
+public:
+  bool isOpen() { return _open; }
+  bool isConnected();
+  void disconnect(); // keeps the session, reconnect() reuses it
+  bool reconnect();
+  uint16_t getConnId();
+  String getServerMacAdress();
+
+  LEServices getServices();
+  LECharacteristic getCharacteristic(const char *service_uuid, const char *characteristic_uuid);
+  LEDescriptor getDescriptor(const char *service_uuid, const char *characteristic_uuid, const char *descriptor_uuid);
+
+  /**
+   * @brief Same contract as the LEClient handle based access, on this session's link.
+   */
+  uint16_t getHandle(const char *service_uuid, const char *characteristic_uuid);
+  const LEAttributeIndex &getAttributeIndex() { return _index; }
+  bool readHandle(uint16_t handle, uint8_t *buffer, size_t capacity, size_t *length);
+  bool writeHandle(uint16_t handle, const uint8_t *data, size_t length, bool response = true);
+  bool readMultiple(LEReadItem *items, size_t count);
+  bool read(const char *service_uuid, const char *characteristic_uuid, uint8_t *buffer, size_t capacity, size_t *length);
+  bool write(const char *service_uuid, const char *characteristic_uuid, const uint8_t *data, size_t length, bool response = true);
+
+  bool tuneLink(const LELinkParams &params);
+  bool tuneLink(LELinkProfile profile);
+  bool getLinkInfo(LELinkInfo &info);
+
+  void setOnDisconnectCallback(LEEventCallback callback) { _callbacks.setOnDisconnectCallback(callback); }
+  void setOnConnectCallback(LEEventCallback callback) { _callbacks.setOnConnectCallback(callback); }
+  template <typename F, typename = typename std::enable_if<LEEventCallback::spills<F>::value>::type>
+  void setOnDisconnectCallback(F &&callback) { _callbacks.setOnDisconnectFunction(LEEventFunction(std::forward<F>(callback))); }
+  template <typename F, typename = typename std::enable_if<LEEventCallback::spills<F>::value>::type>
+  void setOnConnectCallback(F &&callback) { _callbacks.setOnConnectFunction(LEEventFunction(std::forward<F>(callback))); }
+};
+
 class LEClient
 {
 private:
   std::vector<BLERemoteService *> LEServicesVector;
   std::vector<BLERemoteCharacteristic *> LECharacteristicsVector;
   std::vector<BLERemoteDescriptor *> LEDescriptorVector;
-  BLEScan *pBLEScan;
   bool _debug = false;
   void discover();
 
+  TaskHandle_t _connectTask = nullptr;
+  LEConnectOptions _connectOptions;
+  char _connectName[LE_CONNECT_NAME_SIZE];
+  volatile bool _connectCancel = false;
+  static void connectTask(void *client);
+  bool startConnectTask();
+  void runConnect();
+  bool connectAttempt(uint8_t attempt);
+
+  LEConnectOptions _reconnectOptions;
+  LEConnectCallback _reconnectCallback;
+  volatile bool _reconnecting = false;
+  volatile bool _disconnecting = false;
+  uint32_t _linkLostAt = 0;
+  LEReconnectStats _reconnectStats = {0, 0, 0, 0, 0};
+  void onLinkLost();
+  friend class ClientCallbacks;
+
+  LEGattCache _gattCache;
+  LEGattLayout _layout;
+  bool _cacheEnabled = false;
+  uint32_t _cacheVersion = 0;
+  volatile bool _layoutCached = false;
+  bool loadLayout();
+  bool discoverLayout();
+  LEAttributeIndex _index;
+  void indexLayout();
+  volatile uint32_t _linkGeneration = 0; // bumped by the BLE task on link loss
+  uint32_t _indexGeneration = 0;
+  volatile bool _indexed = false;
+  void ensureIndex();
+
+  LESession _sessions[LE_MAX_SESSIONS];
+
 public:
   void begin();
   bool connect(const char *server_name, const uint8_t scan_duration = 5);
   bool connect(LEAddress server_address);
+  /**
+   * @brief Scans for server_name, connects and discovers its attributes on a background task, returning at once.
+   * Every stage has a timeout, failed attempts are retried after an exponential backoff with jitter.
+   * progress is dispatched like the other client events.
+   */
+  bool connectAsync(const char *server_name, LEConnectOptions options = LEConnectOptions(), LEConnectCallback progress = nullptr);
+  void cancelConnect();
+  LEConnectState getConnectState();
+  /**
+   * @brief After an unexpected disconnect, reconnect to the same address on the connect task (no scan),
+   * with the backoff of options, then restore every notify and stream callback by UUID.
+   * Characteristics returned before the link loss are stale, fetch them again after LEConnectReady.
+   */
+  bool setAutoReconnect(bool enabled, LEConnectOptions options = LEConnectOptions(), LEConnectCallback progress = nullptr);
+  LEReconnectStats getReconnectStats();
+
+  /**
+   * @brief Keeps the attribute layout of every peer in NVS. connectAsync and auto-reconnect skip discovery
+   * when the peer's Database Hash still matches the stored one, or, for peers without one, when version does.
+   * Restored notify callbacks then receive a NULL characteristic; getCharacteristic still works but discovers on first use.
+   */
+  void setDiscoveryCache(bool enabled, uint32_t version = 0);
+  bool clearDiscoveryCache();
+  bool isLayoutCached();
+  const LEGattLayout &getLayout();
+
+  /**
+   * @brief Handle based access to the layout of the last connectAsync or auto-reconnect, without BLEClient objects.
+   * getHandle returns 0 when the characteristic is unknown, readHandle returns false when the value exceeds capacity.
+   */
+  uint16_t getHandle(const char *service_uuid, const char *characteristic_uuid);
+  uint16_t getHandle(const LEUUIDKey &service_uuid, const LEUUIDKey &characteristic_uuid);
+  const LEAttributeIndex &getAttributeIndex();
+  bool readHandle(uint16_t handle, uint8_t *buffer, size_t capacity, size_t *length);
+  bool writeHandle(uint16_t handle, const uint8_t *data, size_t length, bool response = true);
+  /**
+   * @brief Reads every item with as few ATT Read Multiple requests as the MTU allows (up to 10 handles each),
+   * one round trip per group instead of one per value. Groups the peer rejects, or whose response does not
+   * match the expected lengths, fall back to single reads. Returns true when every item was read.
+   */
+  bool readMultiple(LEReadItem *items, size_t count);
+  /**
+   * @brief By UUID through the attribute index: one hash lookup, then a handle based request.
+   */
+  bool read(const char *service_uuid, const char *characteristic_uuid, uint8_t *buffer, size_t capacity, size_t *length);
+  bool write(const char *service_uuid, const char *characteristic_uuid, const uint8_t *data, size_t length, bool response = true);
 
   bool isConnected();
   void disconnect();
   bool reconnect();
+
+  /**
+   * @brief Connection settings requested on every new connection, sessions included. The MTU becomes the
+   * local MTU at once, BLEClient exchanges it when a link opens and a peer answers only the first exchange.
+   */
+  bool setLinkParams(const LELinkParams &params);
+  bool setLinkProfile(LELinkProfile profile);
+  /**
+   * @brief Requests new settings on the open link, the negotiated values reach getLinkInfo() and the link callback
+   * once the peer answered. Returns false for an MTU other than the one already exchanged, leave it at 0. The callback also runs when a connection opens, with its initial values,
+   * and is dispatched like the other client events.
+   */
+  bool tuneLink(const LELinkParams &params);
+  bool tuneLink(LELinkProfile profile);
+  bool getLinkInfo(LELinkInfo &info);
+  void setLinkCallback(LELinkCallback callback);
+
+  /**
+   * @brief Connects one more peripheral, up to LE_MAX_SESSIONS besides the single-peer connection.
+   * Blocks like connect() and returns NULL when every session is open or the peer could not be reached.
+   * The name scan shares the scanner with connect() and connectAsync(), do not run them at the same time.
+   */
+  LESession *openSession(LEAddress server_address, esp_ble_addr_type_t type = BLE_ADDR_TYPE_PUBLIC);
+  LESession *openSession(const char *server_name, const uint8_t scan_duration = 5);
+  void closeSession(LESession *session);
+  LESession *getSession(uint32_t index); // NULL for a free slot
+  uint32_t getSessionCount();
    
   
   LEServices getServices();
@@ -183,38 +603,61 @@ public:
   LEDescriptor getDescriptorIndex(const char *service_uuid, const char *characteristic_uuid,const char *descriptor_uuid);
   LEDescriptor getDescriptorByIndex(uint32_t index);
   
-  void setOnDisconnectCallback(void (*callback)());
-  void setOnConnectCallback(void (*callback)());
+  void setOnDisconnectCallback(LEEventCallback callback);
+  void setOnConnectCallback(LEEventCallback callback);
+  void setOnDisconnectFunction(const LEEventFunction &callback);
+  void setOnConnectFunction(const LEEventFunction &callback);
+  template <typename F, typename = typename std::enable_if<LEEventCallback::spills<F>::value>::type>
+  void setOnDisconnectCallback(F &&callback) { setOnDisconnectFunction(LEEventFunction(std::forward<F>(callback))); }
+  template <typename F, typename = typename std::enable_if<LEEventCallback::spills<F>::value>::type>
+  void setOnConnectCallback(F &&callback) { setOnConnectFunction(LEEventFunction(std::forward<F>(callback))); }
 
-  const char *getServerMacAdress();
+  String getServerMacAdress();
 
+  /**
+   * @brief Blocking scan for scan_duration seconds into a cleared store. While a background scan runs,
+   * its store is kept instead and the results are the background devices plus those seen meanwhile.
+   */
   LEScanResults scan(const uint8_t scan_duration);
+  /**
+   * @brief Filter chain applied to every advertisement before it is stored or reported, in scan(), connect() and startScan().
+   * Configure it while no scan is running.
+   */
+  LEScanFilter &getScanFilter();
+  /**
+   * @brief Scans in the background until stopScan(), reporting matching devices through callback
+   * (dispatched like the other client events). A device is reported at most once per report_interval_ms,
+   * 0 reports every advertisement. scan() and connect() pause the background scan and resume it afterwards.
+   */
+  bool startScan(LEAdvertisementCallback callback = nullptr, uint32_t report_interval_ms = 0);
+  void stopScan();
+  bool isScanning();
+  LEScanResults getScanResults();
   void setDebug(bool debug);
+
+  /**
+   * @brief Run connect/disconnect and notify callbacks on the BLE task (default), from poll() or from a worker task pinned to core.
+   */
+  bool setDispatchMode(LEDispatchMode mode, LEDropPolicy policy = LEDropNewest, int core = 1, uint8_t priority = 1);
+  uint32_t poll();
+  LEQueueStats getQueueStats();
+
+  bool isWriting();
+  LEWriteStats getWriteStats(); // of the last bulk write
 };
 
 class AdvertisedDeviceCallbacks : public BLEAdvertisedDeviceCallbacks
 {
 public:
   bool _debug = false;
+  volatile bool _continuous = false;
+  uint32_t _reportInterval = 0;
+  LEScanFilter filter;
+  LEAdvertisementCallback advertisementCallback;
   void onResult(BLEAdvertisedDevice advertisedDevice);
-};
-
-class ClientCallbacks : public BLEClientCallbacks
-{
-public:
-  bool _debug = false;
-  void setOnDisconnectCallback(void (*callback)())
-  {
-    onDisconnectCallback = callback;
-  }
-  void setOnConnectCallback(void (*callback)())
-  {
-    onConnectCallback = callback;
-  }
 
 private:
-  void (*onDisconnectCallback)();
-  void (*onConnectCallback)();
-  void onConnect(BLEClient *_pClient);
-  void onDisconnect(BLEClient *_pClient);
+  void report(const uint8_t *address);
 };
+
+#endif // LEClient_H
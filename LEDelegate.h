@@ -0,0 +1,113 @@
+#ifndef LEDelegate_H
+#define LEDelegate_H
+
+#include <Arduino.h>
+#include <type_traits>
+#include <new>
+#include <utility>
+
+#ifndef LE_DELEGATE_SIZE
+#define LE_DELEGATE_SIZE (3 * sizeof(void *)) // fits an object pointer plus a member function pointer
+#endif
+
+template <typename Signature, size_t Size = LE_DELEGATE_SIZE>
+class LEDelegate;
+
+/**
+ * @brief Callback holding a function pointer or a small trivially copyable callable
+ * (a lambda capturing this or a few values) in inline storage, it never allocates.
+ *
+ *   server.setOnConnectCallback([this](const LEClient &client) { onConnect(client); });
+ *   server.setOnConnectCallback(LEPeerCallback::bind(this, &App::onConnect));
+ */
+template <typename R, typename... Args, size_t Size>
+class LEDelegate<R(Args...), Size>
+{
+private:
+  typedef R (*Invoker)(const void *storage, Args... args);
+
+  typename std::aligned_storage<Size, alignof(void *)>::type _storage;
+  Invoker _invoke = nullptr;
+
+  template <typename F>
+  static R invoke(const void *storage, Args... args)
+  {
+    return (*(F *)storage)(std::forward<Args>(args)...);
+  }
+
+  template <typename F, typename = void>
+  struct isCallable : std::false_type
+  {
+  };
+  template <typename F>
+  struct isCallable<F, decltype((void)std::declval<F &>()(std::declval<Args>()...))> : std::true_type
+  {
+  };
+
+  template <typename T, typename Method>
+  struct Bound
+  {
+    T *object;
+    Method method;
+    R operator()(Args... args) const { return (object->*method)(std::forward<Args>(args)...); }
+  };
+
+public:
+  LEDelegate() {}
+  LEDelegate(std::nullptr_t) {}
+
+  template <typename F,
+            typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, LEDelegate>::value>::type,
+            typename = decltype(std::declval<typename std::decay<F>::type &>()(std::declval<Args>()...))>
+  LEDelegate(F &&callable)
+  {
+    typedef typename std::decay<F>::type Callable;
+    static_assert(sizeof(Callable) <= Size, "LEDelegate: captures too large, capture a pointer or raise LE_DELEGATE_SIZE");
+    static_assert(alignof(Callable) <= alignof(void *), "LEDelegate: over-aligned callable");
+    static_assert(std::is_trivially_copyable<Callable>::value, "LEDelegate: captures must be trivially copyable (pointers, integers)");
+
+    if (std::is_pointer<Callable>::value && isNull(callable))
+      return;
+    new (&_storage) Callable(std::forward<F>(callable));
+    _invoke = &invoke<Callable>;
+  }
+
+  template <typename T>
+  static LEDelegate bind(T *object, R (T::*method)(Args...))
+  {
+    Bound<T, R (T::*)(Args...)> bound = {object, method};
+    return LEDelegate(bound);
+  }
+
+  template <typename T>
+  static LEDelegate bind(const T *object, R (T::*method)(Args...) const)
+  {
+    Bound<const T, R (T::*)(Args...) const> bound = {object, method};
+    return LEDelegate(bound);
+  }
+
+  /**
+   * @brief True for a callable that does not fit a delegate (std::function, std::bind, large or non-trivial captures),
+   * overloads taking std::function use it to accept what a delegate rejects.
+   */
+  template <typename F, typename Callable = typename std::decay<F>::type>
+  struct spills : std::integral_constant<bool, isCallable<Callable>::value && !std::is_same<Callable, LEDelegate>::value &&
+                                                   !(sizeof(Callable) <= Size && alignof(Callable) <= alignof(void *) &&
+                                                     std::is_trivially_copyable<Callable>::value)>
+  {
+  };
+
+  explicit operator bool() const { return _invoke != nullptr; }
+
+  R operator()(Args... args) const { return _invoke(&_storage, std::forward<Args>(args)...); }
+
+private:
+  template <typename F>
+  static bool isNull(const F &callable) { return isNullPointer(callable, std::is_pointer<F>()); }
+  template <typename F>
+  static bool isNullPointer(const F &callable, std::true_type) { return callable == nullptr; }
+  template <typename F>
+  static bool isNullPointer(const F &, std::false_type) { return false; }
+};
+
+#endif // LEDelegate_H
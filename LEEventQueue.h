@@ -0,0 +1,349 @@
+#ifndef LEEventQueue_H
+#define LEEventQueue_H
+
+#include <Arduino.h>
+#include <atomic>
+
+#ifndef LE_EVENT_QUEUE_SIZE
+#define LE_EVENT_QUEUE_SIZE 16 // events, power of two
+#endif
+
+#ifndef LE_EVENT_DATA_SIZE
+#define LE_EVENT_DATA_SIZE 64 // payload bytes copied per event
+#endif
+
+/**
+ * @brief Where user callbacks run.
+ * Direct  : on the BLE stack task, as soon as the event arrives.
+ * Poll    : queued, delivered by poll() from loop().
+ * Task    : queued, delivered by a dedicated worker task.
+ */
+enum LEDispatchMode
+{
+  LEDispatchDirect,
+  LEDispatchPoll,
+  LEDispatchTask,
+};
+
+/**
+ * @brief What to do with a new event when the queue is full.
+ */
+enum LEDropPolicy
+{
+  LEDropNewest,
+  LEDropOldest,
+};
+
+struct LEQueueStats
+{
+  uint32_t queued;
+  uint32_t delivered;
+  uint32_t dropped;
+  uint32_t truncated;
+  uint32_t highWater;
+};
+
+/**
+ * @brief Fixed size lock-free single producer / single consumer ring.
+ * push() must not run concurrently with itself; LEEventDispatcher serializes its producers
+ * (BLE stack task, connect task, write task). The consumer is poll() or the worker task.
+ * With LEDropOldest the producer may advance the tail itself; the consumer only keeps
+ * an event when its own compare-exchange on the tail succeeds, so a slot overwritten
+ * while being copied is discarded and read again.
+ */
+template <typename T, size_t N>
+class LEEventQueue
+{
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "LEEventQueue size must be a power of two");
+
+private:
+  T _slots[N];
+  std::atomic<uint32_t> _head;
+  std::atomic<uint32_t> _tail;
+
+public:
+  LEEventQueue() : _head(0), _tail(0) {}
+
+  LEDropPolicy policy = LEDropNewest;
+  uint32_t queued = 0;  // producer owned
+  uint32_t dropped = 0; // producer owned
+  uint32_t highWater = 0;
+
+  /**
+   * @brief With LEDropOldest an event evicted to make room is copied to evicted (when given) and
+   * didEvict is set, so the caller can release it outside its own lock.
+   */
+  bool push(const T &event, T *evicted = nullptr, bool *didEvict = nullptr)
+  {
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    uint32_t tail = _tail.load(std::memory_order_acquire);
+
+    if (head - tail >= N)
+    {
+      if (policy == LEDropNewest)
+      {
+        dropped++;
+        return false;
+      }
+      // a failed exchange means the consumer just freed the slot
+      if (_tail.compare_exchange_strong(tail, tail + 1, std::memory_order_acq_rel))
+      {
+        dropped++;
+        // the slot is only overwritten below, by this producer
+        if (evicted != nullptr)
+          *evicted = _slots[tail & (N - 1)];
+        if (didEvict != nullptr)
+          *didEvict = true;
+      }
+    }
+
+    _slots[head & (N - 1)] = event;
+    _head.store(head + 1, std::memory_order_release);
+    queued++;
+
+    uint32_t depth = head + 1 - _tail.load(std::memory_order_relaxed);
+    if (depth > highWater)
+      highWater = depth;
+    return true;
+  }
+
+  bool pop(T &event)
+  {
+    uint32_t tail = _tail.load(std::memory_order_acquire);
+    for (;;)
+    {
+      if (tail == _head.load(std::memory_order_acquire))
+        return false;
+      event = _slots[tail & (N - 1)];
+      if (_tail.compare_exchange_weak(tail, tail + 1, std::memory_order_acq_rel))
+        return true;
+    }
+  }
+
+  size_t size() const { return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire); }
+  size_t capacity() const { return N; }
+};
+
+/**
+ * @brief Queue plus delivery, shared by LEServer and LEClient.
+ * The handler runs on the thread that calls poll(), or on the worker task.
+ */
+template <typename T, size_t N = LE_EVENT_QUEUE_SIZE>
+class LEEventDispatcher
+{
+public:
+  typedef void (*Handler)(const T &event, void *context);
+
+  void setHandler(Handler handler, void *context)
+  {
+    _handler = handler;
+    _context = context;
+  }
+
+  /**
+   * @brief Called for a queued event that is dropped without delivery (evicted by LEDropOldest or
+   * discarded by clear()), so events holding a buffer can give it back. A rejected post() is left to its caller.
+   */
+  void setReleaser(Handler releaser) { _releaser = releaser; }
+
+  bool setMode(LEDispatchMode mode, LEDropPolicy policy = LEDropNewest, int core = 1, uint8_t priority = 1, uint32_t stackSize = 4096)
+  {
+    _queue.policy = policy;
+
+    if (mode != LEDispatchTask)
+      stopWorker();
+    if (mode == LEDispatchTask && _task.load() == nullptr)
+    {
+      _core = core;
+      _priority = priority;
+      _stackSize = stackSize;
+      if (!startWorker())
+        return false;
+    }
+
+    _mode = mode;
+
+    // deliver what was queued in the previous mode
+    if (mode == LEDispatchDirect)
+      drain();
+    return true;
+  }
+
+  LEDispatchMode getMode() const { return _mode; }
+  bool isDeferred() const { return _mode != LEDispatchDirect; }
+
+  /**
+   * @brief Safe to call from several tasks at once; the push itself is serialized.
+   */
+  bool post(const T &event)
+  {
+    T evicted;
+    bool didEvict = false;
+    portENTER_CRITICAL(&_postLock);
+    bool queued = _queue.push(event, &evicted, &didEvict);
+    portEXIT_CRITICAL(&_postLock);
+    if (didEvict && _releaser != nullptr)
+      _releaser(evicted, _context);
+
+    // stopWorker() waits for _posting to fall to zero before the handle can go away
+    _posting++;
+    TaskHandle_t task = _task.load();
+    if (task != nullptr)
+      xTaskNotifyGive(task);
+    _posting--;
+    return queued;
+  }
+
+  void noteTruncated() { _truncated++; }
+
+  /**
+   * @brief Discards queued events without delivering them. A worker is stopped first, so no handler
+   * is still running once this returns (the events may point at objects about to be freed), then restarted.
+   */
+  void clear() { empty(false); }
+
+  /**
+   * @brief Like clear(), but the queued events are delivered to the handler on the calling task.
+   */
+  void flush() { empty(true); }
+
+  /**
+   * @brief Delivers queued events, only in LEDispatchPoll mode (the worker owns the queue otherwise).
+   */
+  uint32_t poll()
+  {
+    if (_mode != LEDispatchPoll)
+      return 0;
+    return drain();
+  }
+
+  LEQueueStats getStats() const
+  {
+    LEQueueStats stats;
+    stats.queued = _queue.queued;
+    stats.delivered = _delivered;
+    stats.dropped = _queue.dropped;
+    stats.truncated = _truncated;
+    stats.highWater = _queue.highWater;
+    return stats;
+  }
+
+private:
+  LEEventQueue<T, N> _queue;
+  portMUX_TYPE _postLock = portMUX_INITIALIZER_UNLOCKED;
+  Handler _handler = nullptr;
+  Handler _releaser = nullptr;
+  void *_context = nullptr;
+  volatile LEDispatchMode _mode = LEDispatchDirect;
+  std::atomic<TaskHandle_t> _task{nullptr};
+  std::atomic<uint32_t> _posting{0};
+  volatile bool _exit = false;
+  volatile bool _detached = false;
+  SemaphoreHandle_t _exited = nullptr;
+  int _core = 1;
+  uint8_t _priority = 1;
+  uint32_t _stackSize = 4096;
+  uint32_t _delivered = 0;
+  uint32_t _truncated = 0;
+
+  void empty(bool deliver)
+  {
+    TaskHandle_t task = _task.load();
+    bool restart = task != nullptr && task != xTaskGetCurrentTaskHandle();
+    if (restart)
+      stopWorker();
+
+    T event;
+    while (_queue.pop(event))
+    {
+      if (deliver && _handler != nullptr)
+      {
+        _handler(event, _context);
+        _delivered++;
+      }
+      else if (!deliver && _releaser != nullptr)
+      {
+        _releaser(event, _context);
+      }
+    }
+
+    if (restart)
+      startWorker();
+  }
+
+  uint32_t drain(bool worker = false)
+  {
+    T event;
+    uint32_t count = 0;
+    while (!(worker && _exit) && _queue.pop(event))
+    {
+      if (_handler != nullptr)
+        _handler(event, _context);
+      count++;
+    }
+    _delivered += count;
+    return count;
+  }
+
+  bool startWorker()
+  {
+    // a worker stopped by its own handler is still finishing
+    while (_exit)
+      vTaskDelay(1);
+    if (_exited == nullptr)
+      _exited = xSemaphoreCreateBinary();
+    TaskHandle_t task = nullptr;
+    if (_exited == nullptr || xTaskCreatePinnedToCore(run, "LEEvents", _stackSize, this, _priority, &task, _core) != pdPASS)
+      return false;
+    _task.store(task);
+    return true;
+  }
+
+  /**
+   * @brief Ends the worker after the event it is delivering and waits until it has left drain().
+   * Called from the worker itself (a handler changing the mode) it only asks it to exit.
+   */
+  void stopWorker()
+  {
+    TaskHandle_t task = _task.exchange(nullptr);
+    if (task == nullptr)
+      return;
+
+    // no post() may still hold the handle once the worker deletes itself
+    while (_posting.load() != 0)
+      vTaskDelay(1);
+
+    _exit = true;
+    if (task == xTaskGetCurrentTaskHandle())
+    {
+      _detached = true;
+      return;
+    }
+    xTaskNotifyGive(task);
+    xSemaphoreTake(_exited, portMAX_DELAY);
+    _exit = false;
+  }
+
+  static void run(void *arg)
+  {
+    LEEventDispatcher *dispatcher = (LEEventDispatcher *)arg;
+    while (!dispatcher->_exit)
+    {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      dispatcher->drain(true);
+    }
+    if (dispatcher->_detached)
+    {
+      // stopped by its own handler, nobody waits for it
+      dispatcher->_detached = false;
+      dispatcher->_exit = false;
+    }
+    else
+    {
+      xSemaphoreGive(dispatcher->_exited);
+    }
+    vTaskDelete(nullptr);
+  }
+};
+
+#endif // LEEventQueue_H
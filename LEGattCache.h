@@ -0,0 +1,150 @@
+#ifndef LEGattCache_H
+#define LEGattCache_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <LEUUIDKey.h>
+
+#ifndef LE_GATT_CACHE_SERVICES
+#define LE_GATT_CACHE_SERVICES 8
+#endif
+
+#ifndef LE_GATT_CACHE_CHARACTERISTICS
+#define LE_GATT_CACHE_CHARACTERISTICS 32
+#endif
+
+#define LE_GATT_DATABASE_HASH 0x2B2A // Database Hash characteristic, Bluetooth 5.1
+
+struct LEGattService
+{
+  LEUUIDKey uuid;
+  uint16_t startHandle;
+  uint16_t endHandle;
+};
+
+struct LEGattCharacteristic
+{
+  LEUUIDKey uuid;
+  uint16_t handle;     // value handle
+  uint16_t cccdHandle; // 0 without a Client Characteristic Configuration descriptor
+  uint8_t properties;  // ESP_GATT_CHAR_PROP_BIT_*
+  uint8_t service;     // index into services
+};
+
+/**
+ * @brief Attribute layout of one peer, what a reconnect needs to skip discovery.
+ */
+struct LEGattLayout
+{
+  uint8_t address[6];
+  uint8_t serviceCount;
+  uint8_t characteristicCount;
+  uint32_t version;         // application supplied, see LEClient::setDiscoveryCache
+  uint8_t databaseHash[16]; // all zero when the peer has no Database Hash characteristic
+  LEGattService services[LE_GATT_CACHE_SERVICES];
+  LEGattCharacteristic characteristics[LE_GATT_CACHE_CHARACTERISTICS];
+
+  void clear() { memset(this, 0, sizeof(*this)); }
+
+  bool hasDatabaseHash() const
+  {
+    for (size_t i = 0; i < sizeof(databaseHash); i++)
+    {
+      if (databaseHash[i] != 0)
+        return true;
+    }
+    return false;
+  }
+
+  const LEGattCharacteristic *find(const LEUUIDKey &service, const LEUUIDKey &uuid) const
+  {
+    for (uint8_t i = 0; i < characteristicCount; i++)
+    {
+      const LEGattCharacteristic &characteristic = characteristics[i];
+      if (characteristic.uuid == uuid && services[characteristic.service].uuid == service)
+        return &characteristic;
+    }
+    return nullptr;
+  }
+
+  const LEGattCharacteristic *findHandle(uint16_t handle) const
+  {
+    for (uint8_t i = 0; i < characteristicCount; i++)
+    {
+      if (characteristics[i].handle == handle)
+        return &characteristics[i];
+    }
+    return nullptr;
+  }
+};
+
+/**
+ * @brief Stores one LEGattLayout per peer address as an NVS blob.
+ * Entries whose size does not match the current build are ignored, so changing the limits invalidates them.
+ */
+class LEGattCache
+{
+private:
+  const char *_namespace;
+
+  static void key(const uint8_t *address, char *out)
+  {
+    snprintf(out, 13, "%02x%02x%02x%02x%02x%02x", address[0], address[1], address[2], address[3], address[4], address[5]);
+  }
+
+public:
+  LEGattCache(const char *name = "LEGattCache") : _namespace(name) {}
+
+  bool load(const uint8_t *address, LEGattLayout &layout)
+  {
+    char name[13];
+    key(address, name);
+
+    Preferences preferences;
+    if (!preferences.begin(_namespace, true))
+      return false;
+    bool loaded = preferences.getBytesLength(name) == sizeof(layout) &&
+                  preferences.getBytes(name, &layout, sizeof(layout)) == sizeof(layout) &&
+                  memcmp(layout.address, address, sizeof(layout.address)) == 0;
+    preferences.end();
+    return loaded;
+  }
+
+  bool store(const LEGattLayout &layout)
+  {
+    char name[13];
+    key(layout.address, name);
+
+    Preferences preferences;
+    if (!preferences.begin(_namespace, false))
+      return false;
+    bool stored = preferences.putBytes(name, &layout, sizeof(layout)) == sizeof(layout);
+    preferences.end();
+    return stored;
+  }
+
+  bool erase(const uint8_t *address)
+  {
+    char name[13];
+    key(address, name);
+
+    Preferences preferences;
+    if (!preferences.begin(_namespace, false))
+      return false;
+    bool erased = preferences.remove(name);
+    preferences.end();
+    return erased;
+  }
+
+  bool clear()
+  {
+    Preferences preferences;
+    if (!preferences.begin(_namespace, false))
+      return false;
+    bool cleared = preferences.clear();
+    preferences.end();
+    return cleared;
+  }
+};
+
+#endif // LEGattCache_H
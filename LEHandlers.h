@@ -0,0 +1,112 @@
+#ifndef LEHandlers_H
+#define LEHandlers_H
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+
+#ifndef LE_HANDLER_SLOTS
+#define LE_HANDLER_SLOTS 4 // per stack callback: LEServer, LEClient and a couple of sketch handlers
+#endif
+
+/**
+ * @brief BLEDevice keeps a single custom handler per stack callback. Each chain installs one dispatcher
+ * in that slot and every registered handler sees every event, in registration order.
+ */
+template <typename Chain, typename... Args>
+class LEHandlerChain
+{
+public:
+  typedef void (*Handler)(Args... args);
+
+  static void remove(Handler handler)
+  {
+    Handler *handlers = slots();
+    for (size_t i = 0; i < LE_HANDLER_SLOTS; i++)
+    {
+      if (handlers[i] == handler)
+        handlers[i] = nullptr;
+    }
+  }
+
+protected:
+  static Handler *slots()
+  {
+    static Handler handlers[LE_HANDLER_SLOTS];
+    return handlers;
+  }
+
+  static void dispatch(Args... args)
+  {
+    Handler *handlers = slots();
+    for (size_t i = 0; i < LE_HANDLER_SLOTS; i++)
+    {
+      Handler handler = handlers[i];
+      if (handler != nullptr)
+        handler(args...);
+    }
+  }
+
+  static bool insert(Handler handler)
+  {
+    Handler *handlers = slots();
+    size_t free = LE_HANDLER_SLOTS;
+    for (size_t i = 0; i < LE_HANDLER_SLOTS; i++)
+    {
+      if (handlers[i] == handler)
+        return true;
+      if (handlers[i] == nullptr && free == LE_HANDLER_SLOTS)
+        free = i;
+    }
+    if (free == LE_HANDLER_SLOTS)
+      return false;
+    handlers[free] = handler;
+    return true;
+  }
+};
+
+/**
+ * @brief Register here instead of calling BLEDevice::setCustomGapHandler.
+ */
+class LEGapHandlers : public LEHandlerChain<LEGapHandlers, esp_gap_ble_cb_event_t, esp_ble_gap_cb_param_t *>
+{
+public:
+  static bool add(Handler handler)
+  {
+    if (!insert(handler))
+      return false;
+    BLEDevice::setCustomGapHandler(dispatch);
+    return true;
+  }
+};
+
+/**
+ * @brief Register here instead of calling BLEDevice::setCustomGattcHandler.
+ */
+class LEGattcHandlers : public LEHandlerChain<LEGattcHandlers, esp_gattc_cb_event_t, esp_gatt_if_t, esp_ble_gattc_cb_param_t *>
+{
+public:
+  static bool add(Handler handler)
+  {
+    if (!insert(handler))
+      return false;
+    BLEDevice::setCustomGattcHandler(dispatch);
+    return true;
+  }
+};
+
+/**
+ * @brief Register here instead of calling BLEDevice::setCustomGattsHandler.
+ */
+class LEGattsHandlers : public LEHandlerChain<LEGattsHandlers, esp_gatts_cb_event_t, esp_gatt_if_t, esp_ble_gatts_cb_param_t *>
+{
+public:
+  static bool add(Handler handler)
+  {
+    if (!insert(handler))
+      return false;
+    BLEDevice::setCustomGattsHandler(dispatch);
+    return true;
+  }
+};
+
+#endif // LEHandlers_H
@@ -0,0 +1,209 @@
+#ifndef LELink_H
+#define LELink_H
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+#include <esp_gap_ble_api.h>
+#include <LEDelegate.h>
+#include <LEHandlers.h>
+
+#define LE_PHY_1M 1
+#define LE_PHY_2M 2
+#define LE_PHY_CODED 3
+
+/**
+ * @brief Named sets of connection settings, see LELinkParams::profile.
+ */
+enum LELinkProfile : uint8_t
+{
+  LELinkThroughput, // largest MTU and data length, short interval, 2M PHY
+  LELinkLowLatency, // shortest interval, no peripheral latency
+  LELinkLowPower,   // long interval, peripheral latency, stack default MTU
+};
+
+/**
+ * @brief Requested connection settings shared by LEServer and LEClient, a zero field leaves that setting alone.
+ */
+struct LELinkParams
+{
+  uint16_t mtu;         // ATT MTU, 23 to 517
+  uint16_t minInterval; // 1.25 ms units, 6 to 3200
+  uint16_t maxInterval;
+  uint16_t latency;     // connection events the peripheral may skip
+  uint16_t timeout;     // supervision timeout, 10 ms units
+  uint16_t dataLength;  // link layer payload octets, 27 to 251
+  uint8_t phy;          // LE_PHY_*, only with CONFIG_BT_BLE_50_FEATURES_SUPPORTED (ESP32-C3/S3)
+
+  static LELinkParams profile(LELinkProfile profile)
+  {
+    LELinkParams params;
+    memset(&params, 0, sizeof(params));
+    switch (profile)
+    {
+    case LELinkThroughput:
+      params.mtu = 517;
+      params.minInterval = 6; // 7.5 ms
+      params.maxInterval = 12;
+      params.timeout = 400;
+      params.dataLength = 251;
+      params.phy = LE_PHY_2M;
+      break;
+    case LELinkLowLatency:
+      params.mtu = 247;
+      params.minInterval = 6;
+      params.maxInterval = 6;
+      params.timeout = 200;
+      params.dataLength = 251;
+      params.phy = LE_PHY_2M;
+      break;
+    case LELinkLowPower:
+      params.minInterval = 80; // 100 ms
+      params.maxInterval = 160;
+      params.latency = 4;
+      params.timeout = 600;
+      break;
+    }
+    return params;
+  }
+
+  bool isValid() const
+  {
+    if (mtu != 0 && (mtu < 23 || mtu > 517))
+      return false;
+    if (dataLength != 0 && (dataLength < 27 || dataLength > 251))
+      return false;
+    if (phy > LE_PHY_CODED)
+      return false;
+    if (maxInterval == 0)
+      return true;
+    // the supervision timeout must outlast the longest gap between two events the peripheral listens to
+    return minInterval >= 6 && minInterval <= maxInterval && maxInterval <= 3200 && latency <= 499 &&
+           timeout >= 10 && timeout <= 3200 && (uint32_t)timeout * 4 > (uint32_t)(1 + latency) * maxInterval;
+  }
+};
+
+/**
+ * @brief Effective settings of one connection, as last reported by the stack.
+ */
+struct LELinkInfo
+{
+  uint16_t connId;
+  uint8_t address[6];
+  uint16_t mtu;
+  uint16_t interval; // 1.25 ms units
+  uint16_t latency;
+  uint16_t timeout;  // 10 ms units
+  uint16_t txDataLength;
+  uint16_t rxDataLength;
+  uint8_t txPhy;     // LE_PHY_*
+  uint8_t rxPhy;
+  uint8_t status;    // of the last request the stack answered, 0 on success
+
+  void begin(uint16_t conn_id, const uint8_t *peer, const esp_gatt_conn_params_t &params)
+  {
+    memset(this, 0, sizeof(*this));
+    connId = conn_id;
+    memcpy(address, peer, sizeof(address));
+    mtu = 23; // ATT default until the exchange completes
+    interval = params.interval;
+    latency = params.latency;
+    timeout = params.timeout;
+    txDataLength = 27;
+    rxDataLength = 27;
+    txPhy = LE_PHY_1M;
+    rxPhy = LE_PHY_1M;
+  }
+
+  uint32_t intervalUs() const { return interval * 1250; }
+};
+
+typedef LEDelegate<void(const LELinkInfo &link)> LELinkCallback;
+
+/**
+ * @brief Issues the GAP side of LELinkParams and folds the completion events into LELinkInfo.
+ * The MTU is left to the caller, a client exchanges it and a server only sets what it accepts.
+ */
+class LELinkTuner
+{
+private:
+  uint8_t _dataLengthPeer[6]; // the data length completion carries no address
+  bool _dataLengthPending = false;
+
+public:
+  bool request(const uint8_t *address, const LELinkParams &params)
+  {
+    bool requested = true;
+    if (params.maxInterval != 0)
+    {
+      esp_ble_conn_update_params_t update;
+      memcpy(update.bda, address, sizeof(update.bda));
+      update.min_int = params.minInterval;
+      update.max_int = params.maxInterval;
+      update.latency = params.latency;
+      update.timeout = params.timeout;
+      requested = esp_ble_gap_update_conn_params(&update) == ESP_OK;
+    }
+    if (params.dataLength != 0)
+    {
+      memcpy(_dataLengthPeer, address, sizeof(_dataLengthPeer));
+      _dataLengthPending = true;
+      requested = esp_ble_gap_set_pkt_data_len((uint8_t *)address, params.dataLength) == ESP_OK && requested;
+    }
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+    if (params.phy != 0)
+    {
+      esp_ble_gap_phy_mask_t mask = 1 << (params.phy - 1);
+      requested = esp_ble_gap_set_prefered_phy((uint8_t *)address, 0, mask, mask, ESP_BLE_GAP_PHY_OPTIONS_NO_PREF) == ESP_OK && requested;
+    }
+#endif
+    return requested;
+  }
+
+  /**
+   * @brief Returns true when the event belonged to link and changed it.
+   */
+  bool update(LELinkInfo &link, esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+  {
+    switch (event)
+    {
+    case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
+      if (memcmp(param->update_conn_params.bda, link.address, sizeof(link.address)) != 0)
+        return false;
+      link.status = param->update_conn_params.status;
+      if (param->update_conn_params.status == ESP_BT_STATUS_SUCCESS)
+      {
+        link.interval = param->update_conn_params.conn_int;
+        link.latency = param->update_conn_params.latency;
+        link.timeout = param->update_conn_params.timeout;
+      }
+      return true;
+    case ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT:
+      if (!_dataLengthPending || memcmp(_dataLengthPeer, link.address, sizeof(link.address)) != 0)
+        return false;
+      _dataLengthPending = false;
+      link.status = param->pkt_data_length_cmpl.status;
+      if (param->pkt_data_length_cmpl.status == ESP_BT_STATUS_SUCCESS)
+      {
+        link.txDataLength = param->pkt_data_length_cmpl.params.tx_len;
+        link.rxDataLength = param->pkt_data_length_cmpl.params.rx_len;
+      }
+      return true;
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+    case ESP_GAP_BLE_PHY_UPDATE_COMPLETE_EVT:
+      if (memcmp(param->phy_update.bda, link.address, sizeof(link.address)) != 0)
+        return false;
+      link.status = param->phy_update.status;
+      if (param->phy_update.status == ESP_BT_STATUS_SUCCESS)
+      {
+        link.txPhy = param->phy_update.tx_phy;
+        link.rxPhy = param->phy_update.rx_phy;
+      }
+      return true;
+#endif
+    default:
+      return false;
+    }
+  }
+};
+
+#endif // LELink_H
@@ -0,0 +1,120 @@
+#ifndef LENotifyRing_H
+#define LENotifyRing_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <new>
+
+#ifndef LE_NOTIFY_DATA_SIZE
+#define LE_NOTIFY_DATA_SIZE 32 // payload bytes copied per buffered notification
+#endif
+
+struct LENotification
+{
+  int64_t timestamp; // esp_timer_get_time() on arrival, microseconds
+  uint32_t sequence; // counts every notification received, a gap is an overrun
+  uint16_t length;   // bytes in data
+  bool truncated;    // the notification was longer than LE_NOTIFY_DATA_SIZE
+  uint8_t data[LE_NOTIFY_DATA_SIZE];
+};
+
+struct LENotifyStats
+{
+  uint32_t received;
+  uint32_t overruns;  // dropped because the ring was full
+  uint32_t truncated;
+  uint32_t highWater;
+};
+
+/**
+ * @brief Receive ring of one characteristic, slots allocated once in begin().
+ * Single producer (the BLE task) and single consumer (loop()); when full the newest
+ * notification is dropped, its sequence number is still used so the consumer sees the gap.
+ */
+class LENotifyRing
+{
+private:
+  LENotification *_slots = nullptr;
+  size_t _capacity = 0;
+  std::atomic<uint32_t> _head;
+  std::atomic<uint32_t> _tail;
+  uint32_t _sequence = 0;
+  LENotifyStats _stats = {0, 0, 0, 0};
+
+public:
+  LENotifyRing() : _head(0), _tail(0) {}
+  ~LENotifyRing() { delete[] _slots; }
+
+  /**
+   * @brief slots is rounded up to a power of two. The BLE task may be pushing into a ring that is in use,
+   * so a second begin() never reallocates: it succeeds only when the capacity is unchanged.
+   */
+  bool begin(size_t slots)
+  {
+    size_t capacity = 2;
+    while (capacity < slots)
+      capacity *= 2;
+
+    if (_slots != nullptr)
+      return capacity == _capacity;
+
+    _slots = new (std::nothrow) LENotification[capacity];
+    _capacity = _slots != nullptr ? capacity : 0;
+    _head.store(0);
+    _tail.store(0);
+    _sequence = 0;
+    memset(&_stats, 0, sizeof(_stats));
+    return _slots != nullptr;
+  }
+
+  bool push(const uint8_t *data, size_t length, int64_t timestamp)
+  {
+    uint32_t sequence = _sequence++;
+    _stats.received++;
+
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    if (head - _tail.load(std::memory_order_acquire) >= _capacity)
+    {
+      _stats.overruns++;
+      return false;
+    }
+
+    LENotification &slot = _slots[head & (_capacity - 1)];
+    slot.timestamp = timestamp;
+    slot.sequence = sequence;
+    slot.truncated = length > sizeof(slot.data);
+    slot.length = slot.truncated ? sizeof(slot.data) : length;
+    memcpy(slot.data, data, slot.length);
+    _stats.truncated += slot.truncated;
+    _head.store(head + 1, std::memory_order_release);
+
+    uint32_t depth = head + 1 - _tail.load(std::memory_order_relaxed);
+    if (depth > _stats.highWater)
+      _stats.highWater = depth;
+    return true;
+  }
+
+  size_t available() const { return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_relaxed); }
+
+  bool pop(LENotification &notification) { return pop(&notification, 1) == 1; }
+
+  /**
+   * @brief Batch drain, returns how many notifications were copied to out.
+   */
+  size_t pop(LENotification *out, size_t count)
+  {
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+    size_t available = _head.load(std::memory_order_acquire) - tail;
+    if (count > available)
+      count = available;
+    for (size_t i = 0; i < count; i++)
+      out[i] = _slots[(tail + i) & (_capacity - 1)];
+    _tail.store(tail + count, std::memory_order_release);
+    return count;
+  }
+
+  LENotifyStats getStats() const { return _stats; }
+  size_t capacity() const { return _capacity; }
+};
+
+#endif // LENotifyRing_H
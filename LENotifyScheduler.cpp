@@ -0,0 +1,252 @@
+#include <LENotifyScheduler.h>
+
+LENotifyScheduler::~LENotifyScheduler()
+{
+  end();
+  for (size_t i = 0; i < _channels.size(); i++)
+  {
+    delete[] _channels[i].buffer;
+    delete[] _channels[i].lengths;
+    delete[] _channels[i].sequences;
+  }
+  delete[] _scratch;
+  if (_sending != nullptr)
+    vSemaphoreDelete(_sending);
+}
+
+LENotifyScheduler::Channel *LENotifyScheduler::getChannel(LEHandle handle)
+{
+  if (handle >= _channelIndex.size() || _channelIndex[handle] < 0)
+    return nullptr;
+  return &_channels[_channelIndex[handle]];
+}
+
+bool LENotifyScheduler::configure(LEHandle handle, uint16_t intervalMs, size_t maxLength, LECoalesceMode mode, uint8_t depth)
+{
+  // channels are set up before begin(), buffers are allocated once here
+  if (_timer != nullptr || _server.getCharacteristic(handle) == nullptr || maxLength == 0 || maxLength > 0xFFFF)
+    return false;
+  if (mode == LECoalesceLatest || depth == 0)
+    depth = 1;
+
+  if (handle >= _channelIndex.size())
+    _channelIndex.resize(handle + 1, -1);
+
+  Channel *channel = getChannel(handle);
+  if (channel == nullptr)
+  {
+    Channel entry;
+    memset(&entry, 0, sizeof(entry));
+    _channels.push_back(entry);
+    _channelIndex[handle] = _channels.size() - 1;
+    channel = &_channels.back();
+  }
+
+  delete[] channel->buffer;
+  delete[] channel->lengths;
+  delete[] channel->sequences;
+
+  channel->handle = handle;
+  channel->mode = mode;
+  channel->intervalMs = intervalMs;
+  channel->depth = depth;
+  channel->head = 0;
+  channel->count = 0;
+  channel->lastSent = 0;
+  channel->maxLength = maxLength;
+  channel->buffer = new uint8_t[maxLength * depth];
+  channel->lengths = new uint16_t[depth];
+  channel->sequences = new uint32_t[depth]();
+
+  if (maxLength > _scratchSize)
+  {
+    delete[] _scratch;
+    _scratch = new uint8_t[maxLength];
+    _scratchSize = maxLength;
+  }
+  return true;
+}
+
+// the slot is reserved under the lock and filled outside it, its sequence stays odd meanwhile
+bool LENotifyScheduler::publish(LEHandle handle, const uint8_t *data, size_t length)
+{
+  Channel *channel = nullptr;
+  uint8_t slot = 0;
+
+  portENTER_CRITICAL(&_lock);
+  channel = getChannel(handle);
+  if (channel != nullptr)
+  {
+    uint8_t next = channel->count < channel->depth ? (channel->head + channel->count) % channel->depth : channel->head;
+    // too long, or another publisher is still filling the slot this value would take
+    if (length > channel->maxLength || (channel->sequences[next] & 1) != 0)
+    {
+      channel->stats.dropped++;
+      channel = nullptr;
+    }
+    else
+    {
+      slot = next;
+      if (channel->count < channel->depth)
+      {
+        channel->count++;
+      }
+      else
+      {
+        // full: Latest replaces its single value, Fifo overwrites the oldest
+        channel->head = (channel->head + 1) % channel->depth;
+        channel->stats.coalesced++;
+      }
+      channel->sequences[slot]++;
+      channel->stats.published++;
+    }
+  }
+  portEXIT_CRITICAL(&_lock);
+
+  if (channel == nullptr)
+    return false;
+
+  memcpy(channel->buffer + slot * channel->maxLength, data, length);
+  channel->lengths[slot] = length;
+
+  portENTER_CRITICAL(&_lock);
+  channel->sequences[slot]++;
+  portEXIT_CRITICAL(&_lock);
+  return true;
+}
+
+bool LENotifyScheduler::publish(LEHandle handle, const char *data)
+{
+  return publish(handle, (const uint8_t *)data, strlen(data));
+}
+
+uint32_t LENotifyScheduler::update()
+{
+  if (_sending == nullptr)
+    _sending = xSemaphoreCreateMutex();
+  if (xSemaphoreTake(_sending, 0) != pdTRUE)
+    return 0;
+
+  uint32_t sent = 0;
+  uint32_t now = millis();
+
+  for (size_t i = 0; i < _channels.size(); i++)
+  {
+    Channel &channel = _channels[i];
+    size_t length = 0;
+    uint8_t slot = 0;
+    uint32_t sequence = 0;
+    bool due = false;
+
+    // a slot still being filled is sent on a later tick
+    portENTER_CRITICAL(&_lock);
+    if (channel.count > 0 && (channel.sequences[channel.head] & 1) == 0 &&
+        (channel.lastSent == 0 || now - channel.lastSent >= channel.intervalMs))
+    {
+      slot = channel.head;
+      sequence = channel.sequences[slot];
+      length = channel.lengths[slot];
+      channel.head = (channel.head + 1) % channel.depth;
+      channel.count--;
+      due = true;
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    if (!due)
+      continue;
+
+    memcpy(_scratch, channel.buffer + slot * channel.maxLength, length);
+
+    // a publish that took the slot during the copy queued a newer value, this one was coalesced
+    portENTER_CRITICAL(&_lock);
+    due = channel.sequences[slot] == sequence;
+    if (due)
+    {
+      channel.lastSent = now == 0 ? 1 : now;
+      channel.stats.sent++;
+    }
+    else
+    {
+      channel.stats.coalesced++;
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    if (due)
+    {
+      _server.notify(channel.handle, _scratch, length);
+      sent++;
+    }
+  }
+
+  xSemaphoreGive(_sending);
+  return sent;
+}
+
+bool LENotifyScheduler::begin(uint32_t tickMs)
+{
+  if (_timer != nullptr)
+    return true;
+  if (_sending == nullptr)
+    _sending = xSemaphoreCreateMutex();
+
+  esp_timer_create_args_t args;
+  memset(&args, 0, sizeof(args));
+  args.callback = onTimer;
+  args.arg = this;
+  args.dispatch_method = ESP_TIMER_TASK;
+  args.name = "LENotify";
+
+  if (esp_timer_create(&args, &_timer) != ESP_OK)
+  {
+    _timer = nullptr;
+    return false;
+  }
+  if (esp_timer_start_periodic(_timer, (uint64_t)tickMs * 1000) != ESP_OK)
+  {
+    esp_timer_delete(_timer);
+    _timer = nullptr;
+    return false;
+  }
+  return true;
+}
+
+void LENotifyScheduler::end()
+{
+  if (_timer == nullptr)
+    return;
+  esp_timer_stop(_timer);
+  esp_timer_delete(_timer);
+  _timer = nullptr;
+}
+
+LEChannelStats LENotifyScheduler::getStats(LEHandle handle)
+{
+  LEChannelStats stats;
+  memset(&stats, 0, sizeof(stats));
+
+  portENTER_CRITICAL(&_lock);
+  Channel *channel = getChannel(handle);
+  if (channel != nullptr)
+    stats = channel->stats;
+  portEXIT_CRITICAL(&_lock);
+
+  return stats;
+}
+
+size_t LENotifyScheduler::pending(LEHandle handle)
+{
+  size_t count = 0;
+
+  portENTER_CRITICAL(&_lock);
+  Channel *channel = getChannel(handle);
+  if (channel != nullptr)
+    count = channel->count;
+  portEXIT_CRITICAL(&_lock);
+
+  return count;
+}
+
+void LENotifyScheduler::onTimer(void *arg)
+{
+  ((LENotifyScheduler *)arg)->update();
+}
@@ -0,0 +1,85 @@
+#ifndef LENotifyScheduler_H
+#define LENotifyScheduler_H
+
+#include <LEServer.h>
+#include <esp_timer.h>
+
+#ifndef LE_SCHEDULER_TICK_MS
+#define LE_SCHEDULER_TICK_MS 5
+#endif
+
+/**
+ * @brief Latest keeps only the newest published value, Fifo keeps up to depth values and drops the oldest.
+ */
+enum LECoalesceMode
+{
+  LECoalesceLatest,
+  LECoalesceFifo,
+};
+
+struct LEChannelStats
+{
+  uint32_t published;
+  uint32_t sent;
+  uint32_t coalesced; // values replaced before they were sent
+  uint32_t dropped;   // values rejected (too long or channel not configured)
+};
+
+/**
+ * @brief Rate limited notifications on top of LEServer.
+ * Producers publish() from any task, a periodic timer sends at most one value
+ * per characteristic every intervalMs.
+ */
+class LENotifyScheduler
+{
+public:
+  LENotifyScheduler(LEServer &server) : _server(server) {}
+  ~LENotifyScheduler();
+
+  bool configure(LEHandle handle, uint16_t intervalMs, size_t maxLength, LECoalesceMode mode = LECoalesceLatest, uint8_t depth = 1);
+
+  bool publish(LEHandle handle, const uint8_t *data, size_t length);
+  bool publish(LEHandle handle, const char *data);
+
+  bool begin(uint32_t tickMs = LE_SCHEDULER_TICK_MS);
+  void end();
+
+  /**
+   * @brief Sends every channel that is due, called by the timer or directly from loop() when begin() was not used.
+   */
+  uint32_t update();
+
+  LEChannelStats getStats(LEHandle handle);
+  size_t pending(LEHandle handle);
+
+private:
+  struct Channel
+  {
+    LEHandle handle;
+    LECoalesceMode mode;
+    uint16_t intervalMs;
+    uint8_t depth;
+    uint8_t head;
+    uint8_t count;
+    uint32_t lastSent;
+    size_t maxLength;
+    uint8_t *buffer;
+    uint16_t *lengths;
+    volatile uint32_t *sequences; // per slot, odd while a publisher copies into it
+    LEChannelStats stats;
+  };
+
+  LEServer &_server;
+  std::vector<Channel> _channels;
+  std::vector<int16_t> _channelIndex; // by LEHandle
+  uint8_t *_scratch = nullptr;
+  size_t _scratchSize = 0;
+  esp_timer_handle_t _timer = nullptr;
+  SemaphoreHandle_t _sending = nullptr;
+  portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+
+  Channel *getChannel(LEHandle handle);
+  static void onTimer(void *arg);
+};
+
+#endif // LENotifyScheduler_H
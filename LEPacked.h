@@ -0,0 +1,32 @@
+#ifndef LEPacked_H
+#define LEPacked_H
+
+#include <Arduino.h>
+#include <type_traits>
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "LEPacked sends the in-memory image, which is little endian on ESP32");
+
+/**
+ * @brief Fixed size binary encoding shared by LETypedCharacteristic and LECharacteristic::readAs / writeAs.
+ * Arithmetic types and trivially copyable structs are sent as their little endian memory image,
+ * declare structs with __attribute__((packed)) so both ends agree on the layout.
+ */
+template <typename T>
+struct LEPacked
+{
+  static_assert(std::is_trivially_copyable<T>::value, "LEPacked types must be trivially copyable");
+
+  static const size_t size = sizeof(T);
+
+  static void encode(const T &value, uint8_t *buffer) { memcpy(buffer, &value, sizeof(T)); }
+
+  static bool decode(const uint8_t *buffer, size_t length, T &value)
+  {
+    if (buffer == nullptr || length != sizeof(T))
+      return false;
+    memcpy(&value, buffer, sizeof(T));
+    return true;
+  }
+};
+
+#endif // LEPacked_H
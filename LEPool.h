@@ -0,0 +1,70 @@
+#ifndef LEPool_H
+#define LEPool_H
+
+#include <Arduino.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/**
+ * @brief Fixed capacity object storage, objects are constructed in place and never touch the heap themselves.
+ * create() returns nullptr once all N slots are used.
+ */
+template <typename T, size_t N>
+class LEPool
+{
+private:
+  typename std::aligned_storage<sizeof(T), alignof(T)>::type _storage[N];
+  bool _used[N];
+
+public:
+  LEPool() { memset(_used, 0, sizeof(_used)); }
+  ~LEPool() { clear(); }
+
+  template <typename... Args>
+  T *create(Args &&...args)
+  {
+    for (size_t i = 0; i < N; i++)
+    {
+      if (!_used[i])
+      {
+        _used[i] = true;
+        return new (&_storage[i]) T(std::forward<Args>(args)...);
+      }
+    }
+    return nullptr;
+  }
+
+  void destroy(T *object)
+  {
+    if (object == nullptr)
+      return;
+    size_t i = (typename std::aligned_storage<sizeof(T), alignof(T)>::type *)object - _storage;
+    if (i >= N || !_used[i])
+      return;
+    object->~T();
+    _used[i] = false;
+  }
+
+  void clear()
+  {
+    for (size_t i = 0; i < N; i++)
+    {
+      if (_used[i])
+        destroy(at(i));
+    }
+  }
+
+  T *at(size_t i) { return i < N && _used[i] ? reinterpret_cast<T *>(&_storage[i]) : nullptr; }
+
+  size_t count() const
+  {
+    size_t count = 0;
+    for (size_t i = 0; i < N; i++)
+      count += _used[i];
+    return count;
+  }
+  size_t capacity() const { return N; }
+};
+
+#endif // LEPool_H
@@ -0,0 +1,171 @@
+#ifndef LEScanFilter_H
+#define LEScanFilter_H
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+#include <LEUUIDKey.h>
+#include <LEDelegate.h>
+#include <LEScanStore.h>
+
+#ifndef LE_SCAN_ALLOWLIST
+#define LE_SCAN_ALLOWLIST 8 // addresses
+#endif
+
+#ifndef LE_SCAN_PREFIX_SIZE
+#define LE_SCAN_PREFIX_SIZE 16 // name and manufacturer data prefix bytes
+#endif
+
+/**
+ * @brief A matching device reported by LEClient::startScan.
+ */
+struct LEAdvertisement
+{
+  uint8_t address[6];
+  uint8_t addressType;
+  int8_t rssi;
+  LEScanDevice device;          // statistics, copied when the report was made
+  char name[LE_SCAN_NAME_SIZE]; // empty when none was advertised yet
+};
+
+typedef LEDelegate<void(const LEAdvertisement &advertisement)> LEAdvertisementCallback;
+typedef LEDelegate<bool(BLEAdvertisedDevice &device)> LEScanPredicate;
+
+/**
+ * @brief Conditions an advertisement must all meet, checked cheapest first in onResult.
+ * An empty filter matches everything.
+ *
+ *   client.getScanFilter().setMinRssi(-75).setNamePrefix("Tag").addAddress("c4:4f:33:0a:1b:2c");
+ */
+class LEScanFilter
+{
+private:
+  int8_t _minRssi = -127;
+  uint8_t _addresses[LE_SCAN_ALLOWLIST][6];
+  uint8_t _addressCount = 0;
+  char _namePrefix[LE_SCAN_PREFIX_SIZE];
+  uint8_t _namePrefixLength = 0;
+  uint8_t _manufacturerPrefix[LE_SCAN_PREFIX_SIZE];
+  uint8_t _manufacturerPrefixLength = 0;
+  bool _hasService = false;
+  BLEUUID _service;
+  LEScanPredicate _predicate;
+
+  static bool parseAddress(const char *address, uint8_t *bytes)
+  {
+    if (address == nullptr || strlen(address) != 17)
+      return false;
+    for (size_t i = 0; i < 6; i++)
+    {
+      int8_t high = LEUUIDKey::hexValue(address[i * 3]);
+      int8_t low = LEUUIDKey::hexValue(address[i * 3 + 1]);
+      if (high < 0 || low < 0 || (i < 5 && address[i * 3 + 2] != ':'))
+        return false;
+      bytes[i] = (high << 4) | low;
+    }
+    return true;
+  }
+
+public:
+  LEScanFilter &setMinRssi(int rssi)
+  {
+    _minRssi = rssi;
+    return *this;
+  }
+
+  LEScanFilter &setNamePrefix(const char *prefix)
+  {
+    size_t length = prefix == nullptr ? 0 : strlen(prefix);
+    _namePrefixLength = length < sizeof(_namePrefix) ? length : sizeof(_namePrefix);
+    memcpy(_namePrefix, prefix, _namePrefixLength);
+    return *this;
+  }
+
+  LEScanFilter &setManufacturerPrefix(const uint8_t *prefix, size_t length)
+  {
+    if (prefix == nullptr)
+      length = 0;
+    _manufacturerPrefixLength = length < sizeof(_manufacturerPrefix) ? length : sizeof(_manufacturerPrefix);
+    memcpy(_manufacturerPrefix, prefix, _manufacturerPrefixLength);
+    return *this;
+  }
+
+  LEScanFilter &setServiceUUID(const char *uuid)
+  {
+    LEUUIDKey key;
+    _hasService = LEUUIDKey::fromString(uuid, key);
+    if (_hasService)
+      _service = key.toBLEUUID();
+    return *this;
+  }
+
+  /**
+   * @brief Only addresses added here match, as long as at least one was added. Returns false when full or malformed.
+   */
+  bool addAddress(const char *address)
+  {
+    if (_addressCount >= LE_SCAN_ALLOWLIST || !parseAddress(address, _addresses[_addressCount]))
+      return false;
+    _addressCount++;
+    return true;
+  }
+
+  /**
+   * @brief Last stage, sees the full advertisement once every other condition matched.
+   */
+  LEScanFilter &setPredicate(LEScanPredicate predicate)
+  {
+    _predicate = predicate;
+    return *this;
+  }
+
+  void clear()
+  {
+    _minRssi = -127;
+    _addressCount = 0;
+    _namePrefixLength = 0;
+    _manufacturerPrefixLength = 0;
+    _hasService = false;
+    _predicate = nullptr;
+  }
+
+  bool matches(BLEAdvertisedDevice &device) const
+  {
+    if (device.getRSSI() < _minRssi)
+      return false;
+
+    if (_addressCount > 0)
+    {
+      const uint8_t *address = *device.getAddress().getNative();
+      bool allowed = false;
+      for (uint8_t i = 0; i < _addressCount && !allowed; i++)
+        allowed = memcmp(_addresses[i], address, 6) == 0;
+      if (!allowed)
+        return false;
+    }
+
+    if (_namePrefixLength > 0)
+    {
+      if (!device.haveName())
+        return false;
+      std::string name = device.getName();
+      if (name.length() < _namePrefixLength || memcmp(name.data(), _namePrefix, _namePrefixLength) != 0)
+        return false;
+    }
+
+    if (_manufacturerPrefixLength > 0)
+    {
+      if (!device.haveManufacturerData())
+        return false;
+      std::string data = device.getManufacturerData();
+      if (data.length() < _manufacturerPrefixLength || memcmp(data.data(), _manufacturerPrefix, _manufacturerPrefixLength) != 0)
+        return false;
+    }
+
+    if (_hasService && !device.isAdvertisingService(_service))
+      return false;
+
+    return !_predicate || _predicate(device);
+  }
+};
+
+#endif // LEScanFilter_H
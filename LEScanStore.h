@@ -0,0 +1,393 @@
+#ifndef LEScanStore_H
+#define LEScanStore_H
+
+#include <Arduino.h>
+
+#ifndef LE_SCAN_CAPACITY
+#define LE_SCAN_CAPACITY 256 // devices kept per scan
+#endif
+
+#ifndef LE_SCAN_NAME_POOL
+#define LE_SCAN_NAME_POOL 2048 // bytes for interned names, including terminators
+#endif
+
+#ifndef LE_SCAN_NAME_SLOTS
+#define LE_SCAN_NAME_SLOTS 128 // distinct names, power of two
+#endif
+
+#ifndef LE_SCAN_NAME_SIZE
+#define LE_SCAN_NAME_SIZE 32 // name bytes copied out of the store, including the terminator
+#endif
+
+#define LE_SCAN_NO_NAME 0xFFFF
+
+template <size_t N, size_t P = 1, bool Done = (P >= N)>
+struct LENextPowerOfTwo
+{
+  static const size_t value = LENextPowerOfTwo<N, P * 2>::value;
+};
+template <size_t N, size_t P>
+struct LENextPowerOfTwo<N, P, true>
+{
+  static const size_t value = P;
+};
+
+struct LEScanDevice
+{
+  uint8_t address[6];
+  uint8_t addressType;
+  int8_t rssi; // last advertisement
+  int8_t rssiMin;
+  int8_t rssiMax;
+  int16_t rssiAverage; // exponentially weighted, 1/16 dBm
+  uint16_t seen;
+  uint16_t nameOffset; // into the name pool, LE_SCAN_NO_NAME until a name was advertised
+  uint32_t lastSeen;   // millis()
+  uint32_t lastReported; // millis() of the last LEClient::startScan report, 0 before the first
+
+  float getAverageRssi() const { return rssiAverage / 16.0f; }
+};
+
+/**
+ * @brief Fixed capacity advertisement store, one entry per 48-bit address with RSSI statistics.
+ * Devices are indexed by open addressing on the address, names are interned once in a bounded pool.
+ * Once the store is full new devices are dropped (and counted), or with setEvictOldest() replace the
+ * least recently seen device. A name is freed with the last device using it, a full pool leaves new devices unnamed.
+ * Written by the BLE task and read from loop(), every access takes a spinlock and hands out copies:
+ * entries and names move while a scan keeps recording.
+ */
+class LEScanStore
+{
+private:
+  static_assert(LE_SCAN_CAPACITY < 0xFFFF && LE_SCAN_NAME_POOL < 0xFFFF, "LEScanStore indexes are 16-bit");
+  static_assert((LE_SCAN_NAME_SLOTS & (LE_SCAN_NAME_SLOTS - 1)) == 0, "LE_SCAN_NAME_SLOTS must be a power of two");
+
+  static const size_t SLOTS = LENextPowerOfTwo<LE_SCAN_CAPACITY * 2>::value;
+  static const uint16_t EMPTY = 0xFFFF;
+
+  LEScanDevice _devices[LE_SCAN_CAPACITY];
+  uint16_t _slots[SLOTS];
+  uint16_t _count = 0;
+
+  char _names[LE_SCAN_NAME_POOL];
+  uint16_t _nameSlots[LE_SCAN_NAME_SLOTS];
+  uint16_t _nameRefs[LE_SCAN_NAME_SLOTS]; // devices using the name in the same slot
+  uint16_t _namesUsed = 0;
+  uint16_t _nameCount = 0;
+
+  uint32_t _dropped = 0;
+  uint32_t _evicted = 0;
+  bool _evictOldest = false;
+  mutable portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+
+  static uint32_t hash(const uint8_t *data, size_t length)
+  {
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < length; i++)
+    {
+      hash ^= data[i];
+      hash *= 16777619u;
+    }
+    return hash;
+  }
+
+  uint16_t intern(const char *name, size_t length)
+  {
+    size_t mask = LE_SCAN_NAME_SLOTS - 1;
+    size_t slot = hash((const uint8_t *)name, length) & mask;
+    while (_nameSlots[slot] != LE_SCAN_NO_NAME)
+    {
+      const char *stored = _names + _nameSlots[slot];
+      if (strncmp(stored, name, length) == 0 && stored[length] == '\0')
+      {
+        _nameRefs[slot]++;
+        return _nameSlots[slot];
+      }
+      slot = (slot + 1) & mask;
+    }
+    // keep the name index at most half full and the pool bounded
+    if ((size_t)(_nameCount + 1) * 2 > LE_SCAN_NAME_SLOTS || _namesUsed + length + 1 > LE_SCAN_NAME_POOL)
+      return LE_SCAN_NO_NAME;
+
+    uint16_t offset = _namesUsed;
+    memcpy(_names + offset, name, length);
+    _names[offset + length] = '\0';
+    _namesUsed += length + 1;
+    _nameSlots[slot] = offset;
+    _nameRefs[slot] = 1;
+    _nameCount++;
+    return offset;
+  }
+
+  // drops one reference, the last one removes the name and compacts the pool behind it
+  void release(uint16_t offset)
+  {
+    size_t mask = LE_SCAN_NAME_SLOTS - 1;
+    size_t length = strlen(_names + offset);
+    size_t hole = hash((const uint8_t *)(_names + offset), length) & mask;
+    while (_nameSlots[hole] != offset)
+      hole = (hole + 1) & mask;
+    if (--_nameRefs[hole] > 0)
+      return;
+
+    // backward shift deletion, as for devices
+    size_t next = hole;
+    for (;;)
+    {
+      next = (next + 1) & mask;
+      if (_nameSlots[next] == LE_SCAN_NO_NAME)
+        break;
+      const char *stored = _names + _nameSlots[next];
+      size_t home = hash((const uint8_t *)stored, strlen(stored)) & mask;
+      if (((next - home) & mask) >= ((next - hole) & mask))
+      {
+        _nameSlots[hole] = _nameSlots[next];
+        _nameRefs[hole] = _nameRefs[next];
+        hole = next;
+      }
+    }
+    _nameSlots[hole] = LE_SCAN_NO_NAME;
+    _nameCount--;
+
+    uint16_t size = length + 1;
+    memmove(_names + offset, _names + offset + size, _namesUsed - offset - size);
+    _namesUsed -= size;
+    for (size_t i = 0; i < LE_SCAN_NAME_SLOTS; i++)
+      if (_nameSlots[i] != LE_SCAN_NO_NAME && _nameSlots[i] > offset)
+        _nameSlots[i] -= size;
+    for (size_t i = 0; i < _count; i++)
+      if (_devices[i].nameOffset != LE_SCAN_NO_NAME && _devices[i].nameOffset > offset)
+        _devices[i].nameOffset -= size;
+  }
+
+  void copyName(const LEScanDevice &device, char *name, size_t size) const
+  {
+    if (name == nullptr || size == 0)
+      return;
+    size_t length = 0;
+    if (device.nameOffset != LE_SCAN_NO_NAME)
+    {
+      const char *stored = _names + device.nameOffset;
+      while (length + 1 < size && stored[length] != '\0')
+      {
+        name[length] = stored[length];
+        length++;
+      }
+    }
+    name[length] = '\0';
+  }
+
+  size_t probe(const uint8_t *address) const
+  {
+    size_t mask = SLOTS - 1;
+    size_t slot = hash(address, 6) & mask;
+    while (_slots[slot] != EMPTY && memcmp(_devices[_slots[slot]].address, address, 6) != 0)
+      slot = (slot + 1) & mask;
+    return slot;
+  }
+
+  // drops the least recently seen device from the index and returns its entry for reuse
+  uint16_t evict()
+  {
+    uint32_t now = millis();
+    uint16_t oldest = 0;
+    for (uint16_t i = 1; i < _count; i++)
+      if (now - _devices[i].lastSeen > now - _devices[oldest].lastSeen)
+        oldest = i;
+
+    // backward shift deletion keeps every probe chain unbroken
+    size_t mask = SLOTS - 1;
+    size_t hole = probe(_devices[oldest].address);
+    size_t next = hole;
+    for (;;)
+    {
+      next = (next + 1) & mask;
+      if (_slots[next] == EMPTY)
+        break;
+      size_t home = hash(_devices[_slots[next]].address, 6) & mask;
+      if (((next - home) & mask) >= ((next - hole) & mask))
+      {
+        _slots[hole] = _slots[next];
+        hole = next;
+      }
+    }
+    _slots[hole] = EMPTY;
+    _evicted++;
+
+    uint16_t offset = _devices[oldest].nameOffset;
+    _devices[oldest].nameOffset = LE_SCAN_NO_NAME;
+    if (offset != LE_SCAN_NO_NAME)
+      release(offset);
+    return oldest;
+  }
+
+public:
+  LEScanStore() { clear(); }
+
+  /**
+   * @brief Continuous scans keep reporting new devices by replacing the least recently seen one when full.
+   */
+  void setEvictOldest(bool evict) { _evictOldest = evict; }
+
+  void clear()
+  {
+    portENTER_CRITICAL(&_lock);
+    memset(_slots, 0xFF, sizeof(_slots));
+    memset(_nameSlots, 0xFF, sizeof(_nameSlots));
+    _count = 0;
+    _namesUsed = 0;
+    _nameCount = 0;
+    _dropped = 0;
+    _evicted = 0;
+    portEXIT_CRITICAL(&_lock);
+  }
+
+  /**
+   * @brief Records one advertisement, name may be NULL. Returns false when a new device does not fit.
+   */
+  bool record(const uint8_t *address, uint8_t addressType, int rssi, const char *name, size_t nameLength)
+  {
+    portENTER_CRITICAL(&_lock);
+    size_t slot = probe(address);
+
+    LEScanDevice *device;
+    if (_slots[slot] == EMPTY)
+    {
+      uint16_t index;
+      if (_count < LE_SCAN_CAPACITY)
+      {
+        index = _count++;
+      }
+      else if (_evictOldest)
+      {
+        index = evict();
+        slot = probe(address); // the deletion may have moved the free slot
+      }
+      else
+      {
+        _dropped++;
+        portEXIT_CRITICAL(&_lock);
+        return false;
+      }
+      _slots[slot] = index;
+      device = &_devices[index];
+      memcpy(device->address, address, 6);
+      device->rssiMin = rssi;
+      device->rssiMax = rssi;
+      device->rssiAverage = rssi * 16;
+      device->seen = 0;
+      device->nameOffset = LE_SCAN_NO_NAME;
+      device->lastReported = 0;
+    }
+    else
+    {
+      device = &_devices[_slots[slot]];
+      if (rssi < device->rssiMin)
+        device->rssiMin = rssi;
+      if (rssi > device->rssiMax)
+        device->rssiMax = rssi;
+      device->rssiAverage += (rssi * 16 - device->rssiAverage) / 8;
+    }
+
+    device->addressType = addressType;
+    device->rssi = rssi;
+    device->lastSeen = millis();
+    if (device->seen < 0xFFFF)
+      device->seen++;
+    // the name often arrives later, in a scan response
+    if (device->nameOffset == LE_SCAN_NO_NAME && name != nullptr && nameLength > 0)
+      device->nameOffset = intern(name, nameLength);
+    portEXIT_CRITICAL(&_lock);
+    return true;
+  }
+
+  /**
+   * @brief Copies the device and its name (empty when none) when it was never reported or its last report
+   * is at least interval ms old, and marks it reported. Used by LEClient::startScan.
+   */
+  bool claimReport(const uint8_t *address, uint32_t interval, LEScanDevice &device, char *name, size_t nameSize)
+  {
+    portENTER_CRITICAL(&_lock);
+    size_t slot = probe(address);
+    bool due = false;
+    if (_slots[slot] != EMPTY)
+    {
+      LEScanDevice &stored = _devices[_slots[slot]];
+      uint32_t now = millis();
+      due = interval == 0 || stored.lastReported == 0 || now - stored.lastReported >= interval;
+      if (due)
+      {
+        stored.lastReported = now == 0 ? 1 : now;
+        device = stored;
+        copyName(stored, name, nameSize);
+      }
+    }
+    portEXIT_CRITICAL(&_lock);
+    return due;
+  }
+
+  /**
+   * @brief Copies the device with this address and its name (empty when none), name may be NULL.
+   */
+  bool find(const uint8_t *address, LEScanDevice &device, char *name = nullptr, size_t nameSize = 0) const
+  {
+    portENTER_CRITICAL(&_lock);
+    size_t slot = probe(address);
+    bool found = _slots[slot] != EMPTY;
+    if (found)
+    {
+      device = _devices[_slots[slot]];
+      copyName(device, name, nameSize);
+    }
+    portEXIT_CRITICAL(&_lock);
+    return found;
+  }
+
+  /**
+   * @brief Copies one entry and its name (empty when none) while the scan keeps recording, name may be NULL.
+   */
+  bool read(size_t index, LEScanDevice &device, char *name = nullptr, size_t nameSize = 0) const
+  {
+    portENTER_CRITICAL(&_lock);
+    bool found = index < _count;
+    if (found)
+    {
+      device = _devices[index];
+      copyName(device, name, nameSize);
+    }
+    portEXIT_CRITICAL(&_lock);
+    return found;
+  }
+
+  /**
+   * @brief Copies up to k devices into out ordered by average RSSI, strongest first. find() gives their names.
+   */
+  size_t top(LEScanDevice *out, size_t k) const
+  {
+    portENTER_CRITICAL(&_lock);
+    size_t found = 0;
+    for (size_t i = 0; i < _count; i++)
+    {
+      const LEScanDevice &device = _devices[i];
+      if (found == k && (k == 0 || device.rssiAverage <= out[k - 1].rssiAverage))
+        continue;
+
+      size_t position = found < k ? found++ : k - 1;
+      while (position > 0 && out[position - 1].rssiAverage < device.rssiAverage)
+      {
+        out[position] = out[position - 1];
+        position--;
+      }
+      out[position] = device;
+    }
+    portEXIT_CRITICAL(&_lock);
+    return found;
+  }
+
+  size_t count() const { return _count; }
+  size_t capacity() const { return LE_SCAN_CAPACITY; }
+  uint32_t dropped() const { return _dropped; }
+  uint32_t evicted() const { return _evicted; }
+};
+
+#endif // LEScanStore_H
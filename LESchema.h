@@ -0,0 +1,157 @@
+#ifndef LESchema_H
+#define LESchema_H
+
+#include <Arduino.h>
+#include <LEUUIDKey.h>
+
+struct LEDescriptorDef
+{
+  uint16_t uuid;
+  const char *value; // may be NULL
+};
+
+struct LECharacteristicDef
+{
+  LEUUIDKey uuid;
+  uint32_t properties;
+  const LEDescriptorDef *descriptors;
+  uint8_t descriptorCount;
+  uint16_t *handle; // receives the LEHandle, may be NULL
+};
+
+struct LEServiceDef
+{
+  LEUUIDKey uuid;
+  const LECharacteristicDef *characteristics;
+  uint8_t characteristicCount;
+
+  /**
+   * @brief Attribute handles the service needs: its declaration, two per characteristic, one per descriptor.
+   */
+  uint16_t handleCount() const
+  {
+    uint16_t count = 1;
+    for (uint8_t i = 0; i < characteristicCount; i++)
+      count += 2 + characteristics[i].descriptorCount;
+    return count;
+  }
+};
+
+/**
+ * @brief Compile time GATT table for LEServer::addSchema.
+ * UUID literals are checked and converted to binary by the compiler when the tables are constexpr,
+ * a malformed UUID or unknown descriptor fails the build with a call to a non-constexpr function.
+ *
+ *   LEHandle temperature;
+ *   constexpr LEDescriptorDef temperatureDescriptors[] = {LESchema::descriptor(Configuration)};
+ *   constexpr LECharacteristicDef sensorCharacteristics[] = {
+ *       LESchema::characteristic("beb5483e-36e1-4688-b7f5-ea07361b26a8", Read | Notify, temperatureDescriptors, &temperature)};
+ *   constexpr LEServiceDef schema[] = {LESchema::service("4fafc201-1fb5-459b-8fd3-0c5ad4a35d59", sensorCharacteristics)};
+ *   server.addSchema(schema);
+ */
+struct LESchema
+{
+  template <size_t N>
+  static constexpr LEUUIDKey uuid(const char (&literal)[N])
+  {
+    return valid(literal, N - 1, 0) ? build(literal, N - 1) : uuidLiteralIsInvalid();
+  }
+
+  static constexpr LEDescriptorDef descriptor(uint16_t uuid, const char *value = nullptr)
+  {
+    // ExtendedProperties, UserDescription and Configuration
+    return uuid >= 0x2900 && uuid <= 0x2902 ? LEDescriptorDef{uuid, value} : descriptorIsUnknown();
+  }
+
+  template <size_t N>
+  static constexpr LECharacteristicDef characteristic(const char (&literal)[N], uint32_t properties, uint16_t *handle = nullptr)
+  {
+    return properties != 0 && (properties & ~0x3Fu) == 0
+               ? LECharacteristicDef{uuid(literal), properties, nullptr, 0, handle}
+               : propertiesAreInvalid();
+  }
+
+  template <size_t N, size_t D>
+  static constexpr LECharacteristicDef characteristic(const char (&literal)[N], uint32_t properties, const LEDescriptorDef (&descriptors)[D], uint16_t *handle = nullptr)
+  {
+    return properties != 0 && (properties & ~0x3Fu) == 0 && D < 256
+               ? LECharacteristicDef{uuid(literal), properties, descriptors, (uint8_t)D, handle}
+               : propertiesAreInvalid();
+  }
+
+  template <size_t N, size_t C>
+  static constexpr LEServiceDef service(const char (&literal)[N], const LECharacteristicDef (&characteristics)[C])
+  {
+    return C < 256 ? LEServiceDef{uuid(literal), characteristics, (uint8_t)C} : tooManyCharacteristics();
+  }
+
+private:
+  // reached only for bad input, the compiler reports the function name
+  static LEUUIDKey uuidLiteralIsInvalid() { return LEUUIDKey::base(); }
+  static LEDescriptorDef descriptorIsUnknown() { return LEDescriptorDef{0, nullptr}; }
+  static LECharacteristicDef propertiesAreInvalid() { return LECharacteristicDef{LEUUIDKey::base(), 0, nullptr, 0, nullptr}; }
+  static LEServiceDef tooManyCharacteristics() { return LEServiceDef{LEUUIDKey::base(), nullptr, 0}; }
+
+  template <size_t... I>
+  struct Indices
+  {
+  };
+  template <size_t N, size_t... I>
+  struct MakeIndices : MakeIndices<N - 1, N - 1, I...>
+  {
+  };
+  template <size_t... I>
+  struct MakeIndices<0, I...>
+  {
+    typedef Indices<I...> type;
+  };
+
+  static constexpr int hex(char c)
+  {
+    return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+  }
+
+  static constexpr bool isDash(size_t length, size_t i)
+  {
+    return length == 36 && (i == 8 || i == 13 || i == 18 || i == 23);
+  }
+
+  static constexpr bool valid(const char *literal, size_t length, size_t i)
+  {
+    return (length == 4 || length == 8 || length == 36) &&
+           (i >= length || ((isDash(length, i) ? literal[i] == '-' : hex(literal[i]) >= 0) && valid(literal, length, i + 1)));
+  }
+
+  static constexpr uint8_t pair(const char *literal, size_t position)
+  {
+    return (hex(literal[position]) << 4) | hex(literal[position + 1]);
+  }
+
+  // byte i is least significant first, like LEUUIDKey
+  static constexpr uint8_t byteAt(const char *literal, size_t length, size_t i)
+  {
+    return length == 36 ? pair(literal, position(15 - i))
+           : i < 12     ? (uint8_t) "\xFB\x34\x9B\x5F\x80\x00\x00\x80\x00\x10\x00\x00"[i]
+           : length >= 2 * (i - 12) + 2 ? pair(literal, length - 2 * (i - 12) - 2)
+                                         : 0;
+  }
+
+  // character offset of big endian byte b in the 36 character form
+  static constexpr size_t position(size_t b)
+  {
+    return 2 * b + (b >= 4) + (b >= 6) + (b >= 8) + (b >= 10);
+  }
+
+  template <size_t... I>
+  static constexpr LEUUIDKey build(const char *literal, size_t length, Indices<I...>)
+  {
+    return LEUUIDKey{{byteAt(literal, length, I)...}};
+  }
+
+  static constexpr LEUUIDKey build(const char *literal, size_t length)
+  {
+    return build(literal, length, typename MakeIndices<16>::type());
+  }
+};
+
+#endif // LESchema_H
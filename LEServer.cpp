@@ -1,121 +1,608 @@
 #include <LEServer.h>
+#include <esp_gap_ble_api.h>
+#include <algorithm>
 
-CharacteristicCallbacks characteristicCallbacks;
-std::vector<CharacteristicCallbacks *> characteristicCallbacksVector;
+LEServer *LEServer::_instance = nullptr;
 
-ServerCallback serverCallback;
+void LECharacteristicTable::insert(LEHandle handle)
+{
+  size_t mask = _slots.size() - 1;
+  size_t slot = _entries[handle].uuid.hash() & mask;
+  while (_slots[slot] != LE_INVALID_HANDLE)
+  {
+    // keep the first registration when the same UUID lives in two services
+    if (_entries[_slots[slot]].uuid == _entries[handle].uuid)
+      return;
+    slot = (slot + 1) & mask;
+  }
+  _slots[slot] = handle;
+}
+
+void LECharacteristicTable::insertPointer(LEHandle handle)
+{
+  size_t mask = _pointerSlots.size() - 1;
+  size_t slot = pointerHash(_entries[handle].characteristic) & mask;
+  while (_pointerSlots[slot] != LE_INVALID_HANDLE)
+    slot = (slot + 1) & mask;
+  _pointerSlots[slot] = handle;
+}
+
+LEHandle LECharacteristicTable::add(const LEUUIDKey &uuid, BLECharacteristic *characteristic, uint32_t properties)
+{
+  if (_entries.size() >= LE_INVALID_HANDLE)
+    return LE_INVALID_HANDLE;
+
+  Entry entry;
+  entry.uuid = uuid;
+  entry.characteristic = characteristic;
+  entry.callbacks = nullptr;
+  entry.properties = properties;
+  entry.cccd = nullptr;
+  entry.notifyMask = 0;
+  entry.indicateMask = 0;
+  _entries.push_back(entry);
+
+  // keep the load factor at or below one half
+  size_t slotCount = _slots.empty() ? 16 : _slots.size();
+  while (slotCount < _entries.size() * 2)
+    slotCount *= 2;
+
+  if (slotCount != _slots.size())
+  {
+    _slots.assign(slotCount, LE_INVALID_HANDLE);
+    _pointerSlots.assign(slotCount, LE_INVALID_HANDLE);
+    for (size_t i = 0; i < _entries.size(); i++)
+    {
+      insert(i);
+      insertPointer(i);
+    }
+  }
+  else
+  {
+    insert(_entries.size() - 1);
+    insertPointer(_entries.size() - 1);
+  }
+
+  return _entries.size() - 1;
+}
+
+void LECharacteristicTable::reserve(size_t count)
+{
+  _entries.reserve(count);
+
+  size_t slotCount = _slots.empty() ? 16 : _slots.size();
+  while (slotCount < count * 2)
+    slotCount *= 2;
+  if (slotCount == _slots.size())
+    return;
+
+  _slots.assign(slotCount, LE_INVALID_HANDLE);
+  _pointerSlots.assign(slotCount, LE_INVALID_HANDLE);
+  for (size_t i = 0; i < _entries.size(); i++)
+  {
+    insert(i);
+    insertPointer(i);
+  }
+}
+
+LEHandle LECharacteristicTable::find(const LEUUIDKey &uuid) const
+{
+  if (_slots.empty())
+    return LE_INVALID_HANDLE;
+
+  size_t mask = _slots.size() - 1;
+  size_t slot = uuid.hash() & mask;
+  while (_slots[slot] != LE_INVALID_HANDLE)
+  {
+    if (_entries[_slots[slot]].uuid == uuid)
+      return _slots[slot];
+    slot = (slot + 1) & mask;
+  }
+  return LE_INVALID_HANDLE;
+}
+
+LEHandle LECharacteristicTable::find(const char *uuid) const
+{
+  LEUUIDKey key;
+  if (!LEUUIDKey::fromString(uuid, key))
+    return LE_INVALID_HANDLE;
+  return find(key);
+}
+
+LEHandle LECharacteristicTable::find(const BLECharacteristic *characteristic) const
+{
+  if (_pointerSlots.empty())
+    return LE_INVALID_HANDLE;
+
+  size_t mask = _pointerSlots.size() - 1;
+  size_t slot = pointerHash(characteristic) & mask;
+  while (_pointerSlots[slot] != LE_INVALID_HANDLE)
+  {
+    if (_entries[_pointerSlots[slot]].characteristic == characteristic)
+      return _pointerSlots[slot];
+    slot = (slot + 1) & mask;
+  }
+  return LE_INVALID_HANDLE;
+}
+
+void LECharacteristicTable::indexAttributes()
+{
+  _cccdIndex.clear();
+  _valueIndex.clear();
+  for (size_t i = 0; i < _entries.size(); i++)
+  {
+    Entry &entry = _entries[i];
+    _valueIndex.push_back(((uint32_t)entry.characteristic->getHandle() << 16) | i);
+    if (entry.cccd == nullptr)
+      entry.cccd = entry.characteristic->getDescriptorByUUID(BLEUUID((uint16_t)0x2902));
+    if (entry.cccd != nullptr)
+      _cccdIndex.push_back(((uint32_t)entry.cccd->getHandle() << 16) | i);
+  }
+  std::sort(_cccdIndex.begin(), _cccdIndex.end());
+  std::sort(_valueIndex.begin(), _valueIndex.end());
+}
+
+LEHandle LECharacteristicTable::lookup(const std::vector<uint32_t> &index, uint16_t attributeHandle)
+{
+  std::vector<uint32_t>::const_iterator it = std::lower_bound(index.begin(), index.end(), (uint32_t)attributeHandle << 16);
+  if (it == index.end() || (*it >> 16) != attributeHandle)
+    return LE_INVALID_HANDLE;
+  return *it & 0xFFFF;
+}
+
+void LECharacteristicTable::clear()
+{
+  _entries.clear();
+  _slots.clear();
+  _pointerSlots.clear();
+  _cccdIndex.clear();
+  _valueIndex.clear();
+}
+
+int8_t LEConnectionTable::find(uint16_t connId) const
+{
+  for (int8_t i = 0; i < LE_MAX_CONNECTIONS; i++)
+  {
+    if (_active[i] && _connections[i].connId == connId)
+      return i;
+  }
+  return -1;
+}
+
+int8_t LEConnectionTable::add(uint16_t connId, const uint8_t *address, const esp_gatt_conn_params_t &params)
+{
+  int8_t slot = -1;
+
+  portENTER_CRITICAL(&_lock);
+  slot = find(connId);
+  for (int8_t i = 0; slot < 0 && i < LE_MAX_CONNECTIONS; i++)
+  {
+    if (!_active[i])
+      slot = i;
+  }
+  if (slot >= 0)
+  {
+    LEConnection &connection = _connections[slot];
+    connection.connId = connId;
+    memcpy(connection.address, address, sizeof(connection.address));
+    connection.mtu = 23; // ATT default until the exchange completes
+    connection.connectedAt = millis();
+    connection.txBytes = 0;
+    connection.rxBytes = 0;
+    connection.link.begin(connId, address, params);
+    _active[slot] = true;
+  }
+  portEXIT_CRITICAL(&_lock);
+
+  return slot;
+}
+
+void LEConnectionTable::remove(uint16_t connId)
+{
+  portENTER_CRITICAL(&_lock);
+  int8_t slot = find(connId);
+  if (slot >= 0)
+    _active[slot] = false;
+  portEXIT_CRITICAL(&_lock);
+}
+
+int8_t LEConnectionTable::slotOf(uint16_t connId) const
+{
+  portENTER_CRITICAL(&_lock);
+  int8_t slot = find(connId);
+  portEXIT_CRITICAL(&_lock);
+  return slot;
+}
+
+void LEConnectionTable::setMtu(uint16_t connId, uint16_t mtu)
+{
+  portENTER_CRITICAL(&_lock);
+  int8_t slot = find(connId);
+  if (slot >= 0)
+  {
+    _connections[slot].mtu = mtu;
+    _connections[slot].link.mtu = mtu;
+  }
+  portEXIT_CRITICAL(&_lock);
+}
+
+bool LEConnectionTable::updateLink(LELinkTuner &tuner, esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param, LELinkInfo &link)
+{
+  bool changed = false;
+  portENTER_CRITICAL(&_lock);
+  for (uint8_t i = 0; i < LE_MAX_CONNECTIONS && !changed; i++)
+  {
+    changed = _active[i] && tuner.update(_connections[i].link, event, param);
+    if (changed)
+      link = _connections[i].link;
+  }
+  portEXIT_CRITICAL(&_lock);
+  return changed;
+}
+
+void LEConnectionTable::addRx(uint16_t connId, size_t bytes)
+{
+  portENTER_CRITICAL(&_lock);
+  int8_t slot = find(connId);
+  if (slot >= 0)
+    _connections[slot].rxBytes += bytes;
+  portEXIT_CRITICAL(&_lock);
+}
+
+void LEConnectionTable::addTx(uint16_t connId, size_t bytes)
+{
+  portENTER_CRITICAL(&_lock);
+  int8_t slot = find(connId);
+  if (slot >= 0)
+    _connections[slot].txBytes += bytes;
+  portEXIT_CRITICAL(&_lock);
+}
+
+void LEConnectionTable::addTxAll(size_t bytes)
+{
+  portENTER_CRITICAL(&_lock);
+  for (uint8_t i = 0; i < LE_MAX_CONNECTIONS; i++)
+  {
+    if (_active[i])
+      _connections[i].txBytes += bytes;
+  }
+  portEXIT_CRITICAL(&_lock);
+}
+
+uint8_t LEConnectionTable::count() const
+{
+  uint8_t count = 0;
+  portENTER_CRITICAL(&_lock);
+  for (uint8_t i = 0; i < LE_MAX_CONNECTIONS; i++)
+  {
+    if (_active[i])
+      count++;
+  }
+  portEXIT_CRITICAL(&_lock);
+  return count;
+}
+
+uint8_t LEConnectionTable::snapshot(LEConnection *connections, uint8_t max, uint32_t slots) const
+{
+  uint8_t count = 0;
+  portENTER_CRITICAL(&_lock);
+  for (uint8_t i = 0; i < LE_MAX_CONNECTIONS && count < max; i++)
+  {
+    if (_active[i] && (slots & (1u << i)))
+      connections[count++] = _connections[i];
+  }
+  portEXIT_CRITICAL(&_lock);
+  return count;
+}
+
+bool LEConnectionTable::get(uint16_t connId, LEConnection &connection) const
+{
+  portENTER_CRITICAL(&_lock);
+  int8_t slot = find(connId);
+  if (slot >= 0)
+    connection = _connections[slot];
+  portEXIT_CRITICAL(&_lock);
+  return slot >= 0;
+}
+
+bool LEResponseView::uuidEquals(const char *uuid) const
+{
+  LEUUIDKey key;
+  if (this->uuid == nullptr || !LEUUIDKey::fromString(uuid, key))
+    return false;
+  return *this->uuid == key;
+}
+
+void LEResponseView::getAddress(char *buffer) const
+{
+  snprintf(buffer, 18, "%02x:%02x:%02x:%02x:%02x:%02x", address[0], address[1], address[2], address[3], address[4], address[5]);
+}
+
+String LEResponseView::getAddress() const
+{
+  char buffer[18];
+  getAddress(buffer);
+  return String(buffer);
+}
+
+String LEResponseView::getUUID() const
+{
+  if (characteristic == nullptr)
+    return String();
+  return String(characteristic->getUUID().toString().c_str());
+}
+
+String LEResponseView::getData() const
+{
+  String value;
+  if (data != nullptr)
+    value.concat((const char *)data, length);
+  return value;
+}
+
+LEResponse LEResponseView::toResponse() const
+{
+  LEResponse response;
+
+  response.state = state;
+  response.clientAddress = getAddress();
+  if (characteristic != nullptr)
+    response.uuid.set(characteristic->getUUID());
+  response.uuidStr = getUUID();
+  response.data = getData();
+  response.dataPtr = (uint8_t *)data;
+  response.size = length;
 
-std::vector<BLECharacteristic *> pCharacteristics;
-std::vector<BLEService *> pServices;
+  return response;
+}
 
 void LEServer::setDebug(bool debug)
 {
-  characteristicCallbacks._debug = debug;
-  serverCallback._debug = debug;
-  for (size_t i = 0; i < characteristicCallbacksVector.size(); i++)
+  _debug = debug;
+  _allCallbacks._debug = debug;
+  _serverCallback._debug = debug;
+  for (size_t i = 0; i < _callbackPool.capacity(); i++)
   {
-    characteristicCallbacksVector[i]->_debug = debug;
+    if (_callbackPool.at(i) != nullptr)
+      _callbackPool.at(i)->_debug = debug;
   }
-  
 }
 
-void LEServer::setOnConnectCallback(void (*callback)(LEClient client))
+void LEServer::setOnConnectCallback(LEPeerCallback callback)
 {
-  serverCallback.setOnConnectCallback(callback);
+  _serverCallback.setOnConnectCallback(callback);
 }
 
-void LEServer::setOnDisconnectCallback(void (*callback)(LEClient client))
+void LEServer::setOnDisconnectCallback(LEPeerCallback callback)
 {
-  serverCallback.setOnDisconnectCallback(callback);
+  _serverCallback.setOnDisconnectCallback(callback);
 }
 
 void LEServer::setAllCharacteristicCallback(void (*callback)(LEResponse response))
 {
-  characteristicCallbacks.setCharacteristicCallback(callback);
+  _allCallbacks.setCharacteristicCallback(callback);
+}
+
+void LEServer::setAllCharacteristicCallback(LEResponseCallback callback)
+{
+  _allCallbacks.setCharacteristicCallback(callback);
 }
 
 void LEServer::setCharacteristicCallback(const char *characteristic_uuid, void (*callback)(LEResponse LEResponse))
 {
-   for (size_t i = 0; i < pServices.size(); i++)
+  setCharacteristicCallback(getHandle(characteristic_uuid), callback);
+}
+void LEServer::setCharacteristicCallback(LEHandle handle, void (*callback)(LEResponse LEResponse))
+{
+  CharacteristicCallbacks *characteristicCallback = getCharacteristicCallbacks(handle);
+  if (characteristicCallback != nullptr)
+    characteristicCallback->setCharacteristicCallback(callback);
+}
+void LEServer::setCharacteristicCallback(const char *characteristic_uuid, LEResponseCallback callback)
+{
+  setCharacteristicCallback(getHandle(characteristic_uuid), callback);
+}
+void LEServer::setCharacteristicCallback(LEHandle handle, LEResponseCallback callback)
+{
+  CharacteristicCallbacks *characteristicCallback = getCharacteristicCallbacks(handle);
+  if (characteristicCallback != nullptr)
+    characteristicCallback->setCharacteristicCallback(callback);
+}
+bool LEServer::setValueProvider(const char *characteristic_uuid, LEValueProvider provider, uint32_t ttl_ms)
+{
+  return setValueProvider(getHandle(characteristic_uuid), provider, ttl_ms);
+}
+bool LEServer::setValueProvider(LEHandle handle, LEValueProvider provider, uint32_t ttl_ms)
+{
+  CharacteristicCallbacks *characteristicCallback = getCharacteristicCallbacks(handle);
+  if (characteristicCallback == nullptr)
+    return false;
+  characteristicCallback->setValueProvider(provider, ttl_ms, _providerBuffer, sizeof(_providerBuffer));
+  return true;
+}
+bool LEServer::setReceiveBuffer(LEHandle handle, uint8_t *buffer, size_t capacity)
+{
+  CharacteristicCallbacks *characteristicCallback = getCharacteristicCallbacks(handle);
+  if (characteristicCallback == nullptr || buffer == nullptr || capacity == 0)
+    return false;
+  characteristicCallback->setReceiveBuffer(buffer, capacity);
+  return true;
+}
+LEReceiveStats LEServer::getReceiveStats(LEHandle handle)
+{
+  CharacteristicCallbacks *characteristicCallback = _characteristics.getCallbacks(handle);
+  if (characteristicCallback == nullptr)
   {
-    BLECharacteristic *pCharacteristic = pServices[i]->getCharacteristic(characteristic_uuid);
-    if (pCharacteristic != nullptr)
-    {
-      CharacteristicCallbacks* characteristicCallback;
-      characteristicCallback = new CharacteristicCallbacks;
-      characteristicCallback->setCharacteristicCallback(callback);
-      characteristicCallbacksVector.push_back(characteristicCallback);
+    LEReceiveStats stats = {0, 0, 0};
+    return stats;
+  }
+  return characteristicCallback->getReceiveStats();
+}
+void LEServer::invalidateValue(LEHandle handle)
+{
+  CharacteristicCallbacks *characteristicCallback = _characteristics.getCallbacks(handle);
+  if (characteristicCallback != nullptr)
+    characteristicCallback->invalidate();
+}
+CharacteristicCallbacks *LEServer::getCharacteristicCallbacks(LEHandle handle)
+{
+  BLECharacteristic *pCharacteristic = _characteristics.get(handle);
+  if (pCharacteristic == nullptr)
+    return nullptr;
 
-      pCharacteristic->setCallbacks(characteristicCallback);
-      break;
+  CharacteristicCallbacks *characteristicCallback = _characteristics.getCallbacks(handle);
+  if (characteristicCallback == nullptr)
+  {
+    characteristicCallback = _callbackPool.create();
+    if (characteristicCallback == nullptr)
+    {
+      if (_debug)
+        Serial.println("Characteristic callback pool is full, raise LE_MAX_CHARACTERISTICS.");
+      return nullptr;
     }
+    characteristicCallback->_debug = _debug;
+    characteristicCallback->setTable(&_characteristics, handle);
+    characteristicCallback->_dispatcher = &_events;
+    characteristicCallback->_connections = &_serverCallback.connections;
+
+    pCharacteristic->setCallbacks(characteristicCallback);
+    _characteristics.setCallbacks(handle, characteristicCallback);
   }
+  return characteristicCallback;
 }
 void LEServer::createServer(const char *name)
 {
-  BLEDevice::init(name);
-  pServer = BLEDevice::createServer();
-  pServer->setCallbacks(&serverCallback);
+  if (pServer == nullptr)
+  {
+    _deviceName = name;
+    BLEDevice::init(name);
+    pServer = BLEDevice::createServer();
+    pServer->setCallbacks(&_serverCallback);
+  }
+  _allCallbacks.setTable(&_characteristics);
+
+  _instance = this;
+  _serverCallback._server = this;
+  LEGattsHandlers::add(handleGattsEvent);
+  LEGapHandlers::add(handleGapEvent);
+
+  _events.setHandler(deliverEvent, this);
+  _events.setReleaser(releaseEvent);
+  _serverCallback._dispatcher = &_events;
+  _allCallbacks._dispatcher = &_events;
+  _allCallbacks._connections = &_serverCallback.connections;
 }
 
 void LEServer::addService(const char *uuid)
 {
-  BLEService *pService = pServer->createService(uuid);
-  pServices.push_back(pService);
+  if (_serviceCount >= LE_MAX_SERVICES)
+  {
+    if (_debug)
+      Serial.println("Service table is full, raise LE_MAX_SERVICES.");
+    return;
+  }
+  _services[_serviceCount++] = pServer->createService(uuid);
 }
 
-void LEServer::addCharacteristic(const char *service_uuid, const char *characteristic_uuid, uint32_t properties)
+LEHandle LEServer::addCharacteristic(const char *service_uuid, const char *characteristic_uuid, uint32_t properties)
 {
+  LEUUIDKey uuid;
   BLEService *pService = pServer->getServiceByUUID(service_uuid);
-  BLECharacteristic *pCharacteristic = pService->createCharacteristic(characteristic_uuid, properties);
+  if (pService == nullptr || !LEUUIDKey::fromString(characteristic_uuid, uuid))
+    return LE_INVALID_HANDLE;
+
+  return createCharacteristic(pService, uuid, properties);
+}
+
+LEHandle LEServer::createCharacteristic(BLEService *pService, const LEUUIDKey &uuid, uint32_t properties)
+{
+  BLECharacteristic *pCharacteristic = pService->createCharacteristic(uuid.toBLEUUID(), properties);
 
-  pCharacteristic->setCallbacks(&characteristicCallbacks);
+  pCharacteristic->setCallbacks(&_allCallbacks);
 
-  pCharacteristics.push_back(pCharacteristic);
+  return _characteristics.add(uuid, pCharacteristic, properties);
 }
 
-void LEServer::addDescriptor(const char *characteristic_uuid, uint16_t dicreptor_uuid, const char *descriptor_value)
+bool LEServer::addSchema(const LEServiceDef *services, size_t count)
 {
-  for (size_t i = 0; i < pServices.size(); i++)
+  size_t characteristicCount = _characteristics.count();
+  for (size_t i = 0; i < count; i++)
+    characteristicCount += services[i].characteristicCount;
+  _characteristics.reserve(characteristicCount);
+
+  for (size_t i = 0; i < count; i++)
   {
-    BLECharacteristic *pCharacteristic = pServices[i]->getCharacteristic(characteristic_uuid);
-    if (pCharacteristic != nullptr)
-    {
-      BLEDescriptor *pDescriptor;
-      pDescriptor = new BLEDescriptor(BLEUUID((uint16_t)dicreptor_uuid));
+    const LEServiceDef &service = services[i];
+    if (_serviceCount >= LE_MAX_SERVICES)
+      return false;
+    BLEService *pService = pServer->createService(service.uuid.toBLEUUID(), service.handleCount());
+    if (pService == nullptr)
+      return false;
+    _services[_serviceCount++] = pService;
 
-      if (descriptor_value != NULL)
-      {
-        pDescriptor->setValue(descriptor_value);
-      }
-      pCharacteristic->addDescriptor(pDescriptor);
-      break;
+    for (uint8_t j = 0; j < service.characteristicCount; j++)
+    {
+      const LECharacteristicDef &characteristic = service.characteristics[j];
+      LEHandle handle = createCharacteristic(pService, characteristic.uuid, characteristic.properties);
+      for (uint8_t k = 0; k < characteristic.descriptorCount; k++)
+        addDescriptor(handle, characteristic.descriptors[k].uuid, characteristic.descriptors[k].value);
+      if (characteristic.handle != nullptr)
+        *characteristic.handle = handle;
     }
   }
+  return true;
+}
 
-  
+void LEServer::addDescriptor(const char *characteristic_uuid, uint16_t dicreptor_uuid, const char *descriptor_value)
+{
+  addDescriptor(getHandle(characteristic_uuid), dicreptor_uuid, descriptor_value);
 }
 void LEServer::addDescriptor(const char *characteristic_uuid, uint16_t dicreptor_uuid, uint8_t *data, size_t size)
 {
-   for (size_t i = 0; i < pServices.size(); i++)
+  addDescriptor(getHandle(characteristic_uuid), dicreptor_uuid, data, size);
+}
+void LEServer::addDescriptor(LEHandle handle, uint16_t dicreptor_uuid, const char *descriptor_value)
+{
+  BLECharacteristic *pCharacteristic = _characteristics.get(handle);
+  if (pCharacteristic != nullptr)
   {
-    BLECharacteristic *pCharacteristic = pServices[i]->getCharacteristic(characteristic_uuid);
-    if (pCharacteristic != nullptr)
+    BLEDescriptor *pDescriptor = _descriptorPool.create(BLEUUID((uint16_t)dicreptor_uuid));
+    if (pDescriptor == nullptr)
     {
-      BLEDescriptor *pDescriptor;
-      pDescriptor = new BLEDescriptor(BLEUUID((uint16_t)dicreptor_uuid));
-      pDescriptor->setValue(data,size);
-      
-      pCharacteristic->addDescriptor(pDescriptor);
-      break;
+      if (_debug)
+        Serial.println("Descriptor pool is full, raise LE_MAX_DESCRIPTORS.");
+      return;
+    }
+
+    if (descriptor_value != NULL)
+    {
+      pDescriptor->setValue(descriptor_value);
+    }
+    pCharacteristic->addDescriptor(pDescriptor);
+  }
+}
+void LEServer::addDescriptor(LEHandle handle, uint16_t dicreptor_uuid, uint8_t *data, size_t size)
+{
+  BLECharacteristic *pCharacteristic = _characteristics.get(handle);
+  if (pCharacteristic != nullptr)
+  {
+    BLEDescriptor *pDescriptor = _descriptorPool.create(BLEUUID((uint16_t)dicreptor_uuid));
+    if (pDescriptor == nullptr)
+    {
+      if (_debug)
+        Serial.println("Descriptor pool is full, raise LE_MAX_DESCRIPTORS.");
+      return;
     }
+    pDescriptor->setValue(data, size);
+
+    pCharacteristic->addDescriptor(pDescriptor);
   }
 }
 void LEServer::updateDescriptor(uint16_t dicreptor_uuid, const char *descriptor_value)
 {
-  for (size_t i = 0; i < pCharacteristics.size(); i++)
+  for (size_t i = 0; i < _characteristics.count(); i++)
   {
-    BLEDescriptor *descriptor = pCharacteristics[i]->getDescriptorByUUID(BLEUUID(dicreptor_uuid));
+    BLEDescriptor *descriptor = _characteristics.get(i)->getDescriptorByUUID(BLEUUID(dicreptor_uuid));
     if (descriptor != nullptr)
     {
       descriptor->setValue(descriptor_value);
@@ -125,9 +612,9 @@ void LEServer::updateDescriptor(uint16_t dicreptor_uuid, const char *descriptor_
 }
 void LEServer::updateDescriptor(uint16_t dicreptor_uuid, uint8_t *data, size_t size)
 {
-  for (size_t i = 0; i < pCharacteristics.size(); i++)
+  for (size_t i = 0; i < _characteristics.count(); i++)
   {
-    BLEDescriptor *descriptor = pCharacteristics[i]->getDescriptorByUUID(BLEUUID(dicreptor_uuid));
+    BLEDescriptor *descriptor = _characteristics.get(i)->getDescriptorByUUID(BLEUUID(dicreptor_uuid));
     if (descriptor != nullptr)
     {
       descriptor->setValue(data, size);
@@ -138,45 +625,499 @@ void LEServer::updateDescriptor(uint16_t dicreptor_uuid, uint8_t *data, size_t s
 void LEServer::start()
 {
 
-  for (size_t i = 0; i < pServices.size(); i++)
+  for (uint8_t i = 0; i < _serviceCount; i++)
   {
-    pServices[i]->start();
+    _services[i]->start();
     BLEAdvertising *pAdvertising = BLEDevice::getAdvertising();
-    pAdvertising->addServiceUUID(pServices[i]->getUUID());
+    pAdvertising->addServiceUUID(_services[i]->getUUID());
     pAdvertising->setScanResponse(false);
     pAdvertising->setMinPreferred(0x0);
   }
 
+  // descriptor attribute handles are known once the services are started
+  _characteristics.indexAttributes();
+
   BLEDevice::startAdvertising();
 }
 
+void LEServer::end()
+{
+  if (pServer == nullptr)
+    return;
+
+  BLEAdvertising *pAdvertising = BLEDevice::getAdvertising();
+  pAdvertising->stop();
+
+  LEConnection peers[LE_MAX_CONNECTIONS];
+  uint8_t peerCount = _serverCallback.connections.snapshot(peers, LE_MAX_CONNECTIONS);
+  for (uint8_t i = 0; i < peerCount; i++)
+    pServer->disconnect(peers[i].connId);
+
+  // the disconnects complete on the BLE task, whose events still reach the objects released below
+  uint32_t start = millis();
+  while (_serverCallback.connections.count() > 0 && millis() - start < LE_END_TIMEOUT_MS)
+    delay(10);
+
+  for (uint8_t i = 0; i < _serviceCount; i++)
+  {
+    pAdvertising->removeServiceUUID(_services[i]->getUUID());
+    _services[i]->stop();
+    pServer->removeService(_services[i]);
+  }
+
+  // queued events, including the disconnects above, point at the callback objects released below:
+  // they are delivered here, flush() also waits out a running handler
+  _events.flush();
+
+  for (size_t i = 0; i < _characteristics.count(); i++)
+  {
+    BLECharacteristic *pCharacteristic = _characteristics.get(i);
+    pCharacteristic->setCallbacks(nullptr);
+    delete pCharacteristic;
+  }
+  for (uint8_t i = 0; i < _serviceCount; i++)
+    delete _services[i];
+
+  _serviceCount = 0;
+  _characteristics.clear();
+  _callbackPool.clear();
+  _descriptorPool.clear();
+  _allCallbacks.setCharacteristicCallback((void (*)(LEResponse))nullptr);
+  _allCallbacks.setCharacteristicCallback(LEResponseCallback());
+}
+
 void LEServer::notify(const char *characteristic_uuid, const char *data)
 {
+  notify(getHandle(characteristic_uuid), data);
+}
+void LEServer::notify(const char *characteristic_uuid, uint8_t *data, size_t size)
+{
+  notify(getHandle(characteristic_uuid), data, size);
+}
+void LEServer::notify(LEHandle handle, const char *data)
+{
+  notify(handle, (uint8_t *)data, strlen(data));
+}
+void LEServer::notify(LEHandle handle, uint8_t *data, size_t size)
+{
+  LECharacteristicTable::Entry *entry = _characteristics.at(handle);
+  if (entry == nullptr)
+    return;
+
+  BLECharacteristic *pCharacteristic = entry->characteristic;
+  if (entry->cccd == nullptr)
+  {
+    pCharacteristic->setValue(data, size);
+    pCharacteristic->notify();
+    _serverCallback.connections.addTxAll(size);
+    return;
+  }
 
-  for (size_t i = 0; i < pServices.size(); i++)
+  uint32_t subscribers = entry->notifyMask | entry->indicateMask;
+  if (subscribers == 0)
   {
-    BLECharacteristic *pCharacteristic = pServices[i]->getCharacteristic(characteristic_uuid);
-    if (pCharacteristic != nullptr)
+    // nobody listening, only keep the value fresh for reads
+    if (entry->properties & BLECharacteristic::PROPERTY_READ)
+      pCharacteristic->setValue(data, size);
+    return;
+  }
+
+  pCharacteristic->setValue(data, size);
+
+  // a peer that enabled both gets notifications, indication-only peers get confirmed indications
+  LEConnection peers[LE_MAX_CONNECTIONS];
+  for (int confirm = 0; confirm < 2; confirm++)
+  {
+    uint32_t slots = confirm ? entry->indicateMask & ~entry->notifyMask : entry->notifyMask;
+    uint8_t peerCount = slots != 0 ? _serverCallback.connections.snapshot(peers, LE_MAX_CONNECTIONS, slots) : 0;
+    for (uint8_t i = 0; i < peerCount; i++)
     {
-      pCharacteristic->setValue(data);
-      pCharacteristic->notify();
-      break;
+      size_t length = size > (size_t)peers[i].mtu - 3 ? peers[i].mtu - 3 : size;
+      if (esp_ble_gatts_send_indicate(pServer->getGattsIf(), peers[i].connId, pCharacteristic->getHandle(), length, data, confirm != 0) == ESP_OK)
+        _serverCallback.connections.addTx(peers[i].connId, length);
     }
   }
 }
-void LEServer::notify(const char *characteristic_uuid, uint8_t *data, uint8_t size)
+bool LEServer::notify(uint16_t conn_id, const char *characteristic_uuid, const uint8_t *data, size_t size)
 {
-  for (size_t i = 0; i < pServices.size(); i++)
+  return notify(conn_id, getHandle(characteristic_uuid), data, size);
+}
+bool LEServer::notify(uint16_t conn_id, LEHandle handle, const uint8_t *data, size_t size)
+{
+  LECharacteristicTable::Entry *entry = _characteristics.at(handle);
+  LEConnection connection;
+  if (entry == nullptr || !_serverCallback.connections.get(conn_id, connection))
+    return false;
+  if (size > (size_t)connection.mtu - 3)
+    return false;
+  // looked up once, the peer may disconnect meanwhile
+  int8_t slot = _serverCallback.connections.slotOf(conn_id);
+  if (slot < 0)
+    return false;
+  uint32_t bit = 1u << slot;
+  if (entry->cccd != nullptr && ((entry->notifyMask | entry->indicateMask) & bit) == 0)
+    return false;
+
+  // indicate when this peer only enabled indications
+  bool confirm = entry->cccd != nullptr && (entry->notifyMask & bit) == 0;
+  esp_err_t err = esp_ble_gatts_send_indicate(pServer->getGattsIf(), conn_id, entry->characteristic->getHandle(), size, (uint8_t *)data, confirm);
+  if (err != ESP_OK)
+    return false;
+
+  _serverCallback.connections.addTx(conn_id, size);
+  return true;
+}
+bool LEServer::isSubscribed(LEHandle handle)
+{
+  LECharacteristicTable::Entry *entry = _characteristics.at(handle);
+  return entry != nullptr && (entry->notifyMask | entry->indicateMask) != 0;
+}
+bool LEServer::isSubscribed(const char *characteristic_uuid)
+{
+  return isSubscribed(getHandle(characteristic_uuid));
+}
+bool LEServer::isSubscribed(uint16_t conn_id, LEHandle handle)
+{
+  LECharacteristicTable::Entry *entry = _characteristics.at(handle);
+  int8_t slot = _serverCallback.connections.slotOf(conn_id);
+  if (entry == nullptr || slot < 0)
+    return false;
+  return ((entry->notifyMask | entry->indicateMask) & (1u << slot)) != 0;
+}
+uint8_t LEServer::getSubscriberCount(LEHandle handle)
+{
+  LECharacteristicTable::Entry *entry = _characteristics.at(handle);
+  if (entry == nullptr)
+    return 0;
+  return __builtin_popcount(entry->notifyMask | entry->indicateMask);
+}
+void LEServer::setSubscriptionCallback(LESubscriptionCallback callback)
+{
+  _subscriptionCallback = callback;
+}
+void LEServer::handleGattsEvent(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param)
+{
+  LEServer *server = _instance;
+  if (server == nullptr || server->pServer == nullptr || gatts_if != server->pServer->getGattsIf())
+    return;
+
+  // runs after BLEServer has handled (and answered) the event
+  if (event == ESP_GATTS_CONNECT_EVT)
+  {
+    server->_linkTuner.request(param->connect.remote_bda, server->_linkParams);
+    server->reportLink(param->connect.conn_id);
+  }
+  else if (event == ESP_GATTS_MTU_EVT)
+  {
+    server->reportLink(param->mtu.conn_id);
+  }
+  else if (event == ESP_GATTS_WRITE_EVT)
+  {
+    LEHandle handle = server->_characteristics.findValue(param->write.handle);
+    CharacteristicCallbacks *characteristicCallback = server->_characteristics.getCallbacks(handle);
+    if (characteristicCallback != nullptr && characteristicCallback->hasReceiveBuffer())
+      characteristicCallback->receive(server->_characteristics.get(handle), param);
+    else if (handle == LE_INVALID_HANDLE && !param->write.is_prep && param->write.len == 2)
+      server->onConfigurationWrite(param->write.conn_id, param->write.handle, param->write.value);
+  }
+  else if (event == ESP_GATTS_EXEC_WRITE_EVT)
   {
-    BLECharacteristic *pCharacteristic = pServices[i]->getCharacteristic(characteristic_uuid);
-    if (pCharacteristic != nullptr)
+    bool commit = param->exec_write.exec_write_flag == ESP_GATT_PREP_WRITE_EXEC;
+    for (size_t i = 0; i < server->_characteristics.count(); i++)
     {
-      pCharacteristic->setValue(data, size);
-      pCharacteristic->notify();
-      break;
+      CharacteristicCallbacks *characteristicCallback = server->_characteristics.getCallbacks(i);
+      if (characteristicCallback != nullptr && characteristicCallback->hasReceiveBuffer())
+        characteristicCallback->execute(server->_characteristics.get(i), param->exec_write.conn_id, commit);
     }
   }
 }
+void LEServer::handleGapEvent(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+{
+  LEServer *server = _instance;
+  LELinkInfo link;
+  if (server != nullptr && server->_serverCallback.connections.updateLink(server->_linkTuner, event, param, link))
+    server->reportLink(link);
+}
+void LEServer::reportLink(uint16_t connId)
+{
+  LEConnection connection;
+  if (_serverCallback.connections.get(connId, connection))
+    reportLink(connection.link);
+}
+void LEServer::reportLink(const LELinkInfo &link)
+{
+  if (!_linkCallback)
+    return;
+  if (!_events.isDeferred())
+  {
+    _linkCallback(link);
+    return;
+  }
+
+  LEServerEvent event;
+  static_assert(sizeof(LELinkInfo) <= sizeof(event.data), "LELinkInfo must fit in LE_EVENT_DATA_SIZE");
+  event.type = LEServerEvent::Link;
+  event.target = this;
+  memcpy(event.data, &link, sizeof(link));
+  _events.post(event);
+}
+bool LEServer::setLinkParams(const LELinkParams &params)
+{
+  if (!params.isValid())
+    return false;
+  if (params.mtu != 0 && BLEDevice::setMTU(params.mtu) != ESP_OK)
+    return false;
+  _linkParams = params;
+  return true;
+}
+bool LEServer::setLinkProfile(LELinkProfile profile)
+{
+  return setLinkParams(LELinkParams::profile(profile));
+}
+bool LEServer::tuneLink(uint16_t conn_id, const LELinkParams &params)
+{
+  LEConnection connection;
+  if (!params.isValid() || !_serverCallback.connections.get(conn_id, connection))
+    return false;
+  // the MTU is exchanged once per connection and the local MTU is global, setLinkParams covers new links
+  if (params.mtu != 0 && params.mtu != connection.mtu)
+    return false;
+  return _linkTuner.request(connection.address, params);
+}
+bool LEServer::tuneLink(uint16_t conn_id, LELinkProfile profile)
+{
+  LELinkParams params = LELinkParams::profile(profile);
+  params.mtu = 0; // already exchanged
+  return tuneLink(conn_id, params);
+}
+bool LEServer::getLinkInfo(uint16_t conn_id, LELinkInfo &info)
+{
+  LEConnection connection;
+  if (!_serverCallback.connections.get(conn_id, connection))
+    return false;
+  info = connection.link;
+  return true;
+}
+void LEServer::setLinkCallback(LELinkCallback callback)
+{
+  _linkCallback = callback;
+}
+void LEServer::onConfigurationWrite(uint16_t connId, uint16_t attributeHandle, const uint8_t *value)
+{
+  LEHandle handle = _characteristics.findCCCD(attributeHandle);
+  LECharacteristicTable::Entry *entry = _characteristics.at(handle);
+  int8_t slot = _serverCallback.connections.slotOf(connId);
+  if (entry == nullptr || slot < 0)
+    return;
+
+  uint32_t bit = 1u << slot;
+  uint32_t notifyMask = (value[0] & 0x01) ? entry->notifyMask | bit : entry->notifyMask & ~bit;
+  uint32_t indicateMask = (value[0] & 0x02) ? entry->indicateMask | bit : entry->indicateMask & ~bit;
+  if (notifyMask == entry->notifyMask && indicateMask == entry->indicateMask)
+    return;
+
+  entry->notifyMask = notifyMask;
+  entry->indicateMask = indicateMask;
+  subscriptionChanged(handle, connId, bit);
+}
+void LEServer::clearSubscriptions(uint16_t connId)
+{
+  int8_t slot = _serverCallback.connections.slotOf(connId);
+  if (slot < 0)
+    return;
+
+  uint32_t bit = 1u << slot;
+  for (size_t i = 0; i < _characteristics.count(); i++)
+  {
+    LECharacteristicTable::Entry *entry = _characteristics.at(i);
+    if (((entry->notifyMask | entry->indicateMask) & bit) == 0)
+      continue;
+    entry->notifyMask &= ~bit;
+    entry->indicateMask &= ~bit;
+    subscriptionChanged(i, connId, bit);
+  }
+}
+void LEServer::subscriptionChanged(LEHandle handle, uint16_t connId, uint32_t bit)
+{
+  LECharacteristicTable::Entry *entry = _characteristics.at(handle);
+
+  LESubscription subscription;
+  subscription.handle = handle;
+  subscription.connId = connId;
+  subscription.notifications = (entry->notifyMask & bit) != 0;
+  subscription.indications = (entry->indicateMask & bit) != 0;
+  subscription.subscribers = getSubscriberCount(handle);
+
+  if (_debug)
+  {
+    Serial.printf("Subscription Changed, Id : %u , Handle : %u , Notify : %d , Indicate : %d , Subscribers : %u\n",
+                  connId, handle, subscription.notifications, subscription.indications, subscription.subscribers);
+  }
+
+  if (!_subscriptionCallback)
+    return;
+
+  if (_events.isDeferred())
+  {
+    LEServerEvent event;
+    event.type = LEServerEvent::Subscription;
+    event.target = this;
+    event.count = subscription.subscribers;
+    event.view.handle = handle;
+    event.view.connId = connId;
+    event.data[0] = (subscription.notifications ? 0x01 : 0) | (subscription.indications ? 0x02 : 0);
+    _events.post(event);
+  }
+  else
+  {
+    _subscriptionCallback(subscription);
+  }
+}
+uint8_t LEServer::getConnectionCount()
+{
+  return _serverCallback.connections.count();
+}
+uint8_t LEServer::getConnections(LEConnection *connections, uint8_t max)
+{
+  return _serverCallback.connections.snapshot(connections, max);
+}
+bool LEServer::getConnection(uint16_t conn_id, LEConnection &connection)
+{
+  return _serverCallback.connections.get(conn_id, connection);
+}
+void LEServer::forEachConnection(LEConnectionCallback callback)
+{
+  if (!callback)
+    return;
+
+  LEConnection connections[LE_MAX_CONNECTIONS];
+  uint8_t count = _serverCallback.connections.snapshot(connections, LE_MAX_CONNECTIONS);
+  for (uint8_t i = 0; i < count; i++)
+    callback(connections[i]);
+}
+bool LEServer::stream(LEHandle handle, const uint8_t *data, size_t length, uint32_t timeout_ms)
+{
+  LECharacteristicTable::Entry *entry = _characteristics.at(handle);
+  if (entry == nullptr || pServer == nullptr)
+    return false;
+
+  // only peers that enabled notifications when the characteristic has a Configuration descriptor
+  uint32_t targets = entry->cccd != nullptr ? (uint32_t)entry->notifyMask : 0xFFFFFFFF;
+  LEConnection peers[LE_MAX_CONNECTIONS];
+  uint8_t peerCount = _serverCallback.connections.snapshot(peers, LE_MAX_CONNECTIONS, targets);
+  if (peerCount == 0)
+    return false;
+
+  uint16_t mtu = ESP_GATT_MAX_MTU_SIZE;
+  for (uint8_t i = 0; i < peerCount; i++)
+  {
+    if (peers[i].mtu < mtu)
+      mtu = peers[i].mtu;
+  }
+
+  size_t fragmentSize = mtu - 3;
+  if (fragmentSize <= LE_STREAM_START_HEADER_SIZE)
+    return false;
+
+  uint8_t fragment[ESP_GATT_MAX_MTU_SIZE];
+  LEStreamHeader header;
+  header.messageId = _streamId++;
+  header.index = 0;
+  header.totalLength = length;
+
+  size_t offset = 0;
+  uint32_t start = millis();
+  do
+  {
+    header.flags = header.index == 0 ? LE_STREAM_START : 0;
+    size_t headerSize = header.size();
+    size_t payload = length - offset;
+    if (payload > fragmentSize - headerSize)
+      payload = fragmentSize - headerSize;
+    if (offset + payload == length)
+      header.flags |= LE_STREAM_END;
+
+    header.encode(fragment);
+    memcpy(fragment + headerSize, data + offset, payload);
+
+    // wait until every peer has a free controller buffer
+    for (uint8_t i = 0; i < peerCount; i++)
+    {
+      while (esp_ble_get_cur_sendable_packets_num(peers[i].connId) == 0)
+      {
+        if (millis() - start > timeout_ms)
+          return false;
+        vTaskDelay(1);
+      }
+    }
+
+    for (uint8_t i = 0; i < peerCount; i++)
+    {
+      if (esp_ble_gatts_send_indicate(pServer->getGattsIf(), peers[i].connId, entry->characteristic->getHandle(), headerSize + payload, fragment, false) == ESP_OK)
+        _serverCallback.connections.addTx(peers[i].connId, headerSize + payload);
+    }
+
+    offset += payload;
+    header.index++;
+  } while (offset < length);
+
+  return true;
+}
+
+bool LEServer::setDispatchMode(LEDispatchMode mode, LEDropPolicy policy, int core, uint8_t priority)
+{
+  return _events.setMode(mode, policy, core, priority);
+}
+uint32_t LEServer::poll()
+{
+  return _events.poll();
+}
+LEQueueStats LEServer::getQueueStats()
+{
+  return _events.getStats();
+}
+void LEServer::releaseEvent(const LEServerEvent &event, void *context)
+{
+  if (event.type == LEServerEvent::Received)
+    ((CharacteristicCallbacks *)event.target)->releaseReceived();
+}
+void LEServer::deliverEvent(const LEServerEvent &event, void *context)
+{
+  if (event.type == LEServerEvent::Characteristic)
+  {
+    LEResponseView view = event.view;
+    view.data = event.data;
+    ((CharacteristicCallbacks *)event.target)->deliver(view);
+  }
+  else if (event.type == LEServerEvent::Received)
+  {
+    ((CharacteristicCallbacks *)event.target)->deliverReceived(event.view);
+  }
+  else if (event.type == LEServerEvent::Link)
+  {
+    LEServer *server = (LEServer *)event.target;
+    LELinkInfo link;
+    memcpy(&link, event.data, sizeof(link));
+    if (server->_linkCallback)
+      server->_linkCallback(link);
+  }
+  else if (event.type == LEServerEvent::Subscription)
+  {
+    LEServer *server = (LEServer *)event.target;
+    LESubscription subscription;
+    subscription.handle = event.view.handle;
+    subscription.connId = event.view.connId;
+    subscription.notifications = (event.data[0] & 0x01) != 0;
+    subscription.indications = (event.data[0] & 0x02) != 0;
+    subscription.subscribers = event.count;
+    if (server->_subscriptionCallback)
+      server->_subscriptionCallback(subscription);
+  }
+  else
+  {
+    ((ServerCallback *)event.target)->deliver(event.type, event.view.connId, event.view.address, event.count);
+  }
+}
 BLEServer* LEServer::getServer()
 {
     return pServer;
@@ -192,13 +1133,35 @@ BLEService* LEServer::getService(const char *service_uuid)
 }
 BLECharacteristic* LEServer::getCharacteristic(const char *characteristic_uuid)
 {
-  for (size_t i = 0; i < pServices.size(); i++)
+  return _characteristics.get(_characteristics.find(characteristic_uuid));
+}
+BLECharacteristic* LEServer::getCharacteristic(LEHandle handle)
+{
+  return _characteristics.get(handle);
+}
+LEHandle LEServer::getHandle(const char *characteristic_uuid)
+{
+  return _characteristics.find(characteristic_uuid);
+}
+void ServerCallback::onDisconnect(BLEServer *pServer, esp_ble_gatts_cb_param_t *param)
+{
+  uint16_t ClientID = param->disconnect.conn_id;
+
+  clientCount--;
+  if (_server != nullptr)
+    _server->clearSubscriptions(ClientID);
+  connections.remove(ClientID);
+
+  if (_debug)
   {
-    BLECharacteristic *pCharacteristic = pServices[i]->getCharacteristic(characteristic_uuid);
-    if (pCharacteristic != nullptr)
-    {
-      return pCharacteristic;
-    }
+    BLEAddress ClientAddress = param->disconnect.remote_bda;
+    Serial.print("Client Disconnected , Id : ");
+    Serial.print(ClientID);
+    Serial.print(" , Adress : ");
+    Serial.print(ClientAddress.toString().c_str());
+    Serial.print(" , Connected Devices : ");
+    Serial.println(clientCount);
   }
-  return nullptr;
-}
\ No newline at end of file
+
+  dispatch(LEServerEvent::Disconnect, ClientID, param->disconnect.remote_bda);
+}
@@ -5,6 +5,13 @@
 #include <BLEDevice.h>
 #include <BLEServer.h>
 #include <vector>
+#include <LEUUIDKey.h>
+#include <LEEventQueue.h>
+#include <LEStream.h>
+#include <LESchema.h>
+#include <LEPool.h>
+#include <LEDelegate.h>
+#include <LELink.h>
 
 typedef enum
 {
@@ -14,6 +21,12 @@ typedef enum
   onStatus
 } LEState;
 
+/**
+ * @brief Opaque characteristic handle returned by LEServer::addCharacteristic.
+ */
+typedef uint16_t LEHandle;
+const LEHandle LE_INVALID_HANDLE = 0xFFFF;
+
 class LEUUID
 {
 private:
@@ -40,6 +53,29 @@ struct LEResponse
   uint8_t size;
 };
 
+/**
+ * @brief Allocation free view of a characteristic event, data points into the stack's buffer
+ * and is only valid for the duration of the callback.
+ */
+struct LEResponseView
+{
+  LEState state;
+  LEHandle handle;
+  uint16_t connId;
+  uint8_t address[6];
+  const uint8_t *data;
+  size_t length;
+  BLECharacteristic *characteristic;
+  const LEUUIDKey *uuid;
+
+  bool uuidEquals(const char *uuid) const;
+  void getAddress(char *buffer) const; // buffer of at least 18 bytes
+  String getAddress() const;
+  String getUUID() const;
+  String getData() const;
+  LEResponse toResponse() const;
+};
+
 struct LEClient
 {
   String address;
@@ -47,6 +83,110 @@ struct LEClient
   uint16_t count;
 };
 
+#ifndef LE_MAX_SERVICES
+#define LE_MAX_SERVICES 8
+#endif
+
+#ifndef LE_MAX_CHARACTERISTICS
+#define LE_MAX_CHARACTERISTICS 16 // characteristics with their own callback
+#endif
+
+#ifndef LE_MAX_DESCRIPTORS
+#define LE_MAX_DESCRIPTORS 16
+#endif
+
+#ifndef LE_PROVIDER_BUFFER_SIZE
+#define LE_PROVIDER_BUFFER_SIZE 128 // largest value a value provider can produce
+#endif
+
+#ifndef LE_MAX_CONNECTIONS
+#ifdef CONFIG_BTDM_CTRL_BLE_MAX_CONN
+#define LE_MAX_CONNECTIONS CONFIG_BTDM_CTRL_BLE_MAX_CONN
+#else
+#define LE_MAX_CONNECTIONS 3 // the controller's default CONFIG_BTDM_CTRL_BLE_MAX_CONN
+#endif
+#endif
+
+#ifndef LE_END_TIMEOUT_MS
+#define LE_END_TIMEOUT_MS 1000 // end() waits this long for its disconnects to complete
+#endif
+
+struct LEConnection
+{
+  uint16_t connId;
+  uint8_t address[6];
+  uint16_t mtu;
+  uint32_t connectedAt; // millis()
+  uint32_t txBytes;
+  uint32_t rxBytes;
+  LELinkInfo link; // negotiated connection settings
+};
+
+/**
+ * @brief Fixed capacity table of live connections, written by the BLE task and read by the user through copies.
+ */
+class LEConnectionTable
+{
+private:
+  LEConnection _connections[LE_MAX_CONNECTIONS];
+  bool _active[LE_MAX_CONNECTIONS];
+  mutable portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+
+  int8_t find(uint16_t connId) const;
+
+public:
+  LEConnectionTable() { memset(_active, 0, sizeof(_active)); }
+
+  int8_t add(uint16_t connId, const uint8_t *address, const esp_gatt_conn_params_t &params);
+  void remove(uint16_t connId);
+  int8_t slotOf(uint16_t connId) const;
+
+  void setMtu(uint16_t connId, uint16_t mtu);
+  bool updateLink(LELinkTuner &tuner, esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param, LELinkInfo &link);
+  void addRx(uint16_t connId, size_t bytes);
+  void addTx(uint16_t connId, size_t bytes);
+  void addTxAll(size_t bytes);
+
+  uint8_t count() const;
+  uint8_t snapshot(LEConnection *connections, uint8_t max, uint32_t slots = 0xFFFFFFFF) const;
+  bool get(uint16_t connId, LEConnection &connection) const;
+};
+
+/**
+ * @brief Copy of a server event queued for deferred delivery.
+ */
+struct LEServerEvent
+{
+  enum Type : uint8_t
+  {
+    Connect,
+    Disconnect,
+    Characteristic,
+    Subscription,
+    Received,
+    Link, // data holds the LELinkInfo
+  } type;
+  void *target;
+  uint16_t count;
+  LEResponseView view;
+  uint8_t data[LE_EVENT_DATA_SIZE];
+};
+
+typedef LEEventDispatcher<LEServerEvent> LEServerDispatcher;
+
+/**
+ * @brief Reported when a connection writes the Configuration descriptor of a characteristic,
+ * or disconnects while subscribed.
+ */
+struct LESubscription
+{
+  LEHandle handle;
+  uint16_t connId;
+  bool notifications;
+  bool indications;
+  uint8_t subscribers; // connections still subscribed to the characteristic
+};
+
 enum LEPropertie
 {
   Read = 1 << 0,
@@ -67,180 +207,454 @@ enum LEDescriptor
   Configuration = 0x2902,
 };
 
-class LEServer
-{
-private:
-  BLEServer *pServer = NULL;
-  String _deviceName;
-  bool _debug = false;
-  
-public:
-  void createServer(const char *name);
-
-  void addService(const char *uuid);
+class CharacteristicCallbacks;
+class LEServer;
 
-  void addCharacteristic(const char *service_uuid, const char *characteristic_uuid, uint32_t properties);
+struct LEReceiveStats
+{
+  uint32_t messages;
+  uint32_t overruns; // writes dropped while the previous message was still undelivered
+  uint32_t errors;   // oversized writes, or writes from a second connection during a prepared write
+};
 
-  void addDescriptor(const char *characteristic_uuid, uint16_t dicreptor_uuid, const char *descriptor_value = NULL);
-  void addDescriptor(const char *characteristic_uuid, uint16_t dicreptor_uuid, uint8_t *data, size_t size);
+/**
+ * @brief Caller owned storage a characteristic reassembles writes into, including Prepare/Execute long writes.
+ */
+struct LEReceiveBuffer
+{
+  uint8_t *data = nullptr;
+  size_t capacity = 0;
+  size_t length = 0;
+  uint16_t connId = 0;
+  uint8_t address[6];
+  bool pending = false; // prepared write in progress
+  bool error = false;
+  volatile bool busy = false; // completed message queued for delivery
+  LEReceiveStats stats = {0, 0, 0};
+};
 
-  void updateDescriptor(uint16_t dicreptor_uuid, const char *descriptor_value);
-  void updateDescriptor(uint16_t dicreptor_uuid, uint8_t *data, size_t size);
+/**
+ * @brief Samples a characteristic value on demand, writes at most capacity bytes and returns the length.
+ * Returning 0 keeps the current value.
+ */
+typedef LEDelegate<size_t(LEHandle handle, uint8_t *buffer, size_t capacity)> LEValueProvider;
 
-  void setOnConnectCallback(void (*callback)(LEClient LEClient));
-  void setOnDisconnectCallback(void (*callback)(LEClient LEClient));
+typedef LEDelegate<void(const LEClient &client)> LEPeerCallback;
+typedef LEDelegate<void(const LEResponseView &response)> LEResponseCallback;
+typedef LEDelegate<void(const LESubscription &subscription)> LESubscriptionCallback;
+typedef LEDelegate<void(const LEConnection &connection)> LEConnectionCallback;
 
-  void setAllCharacteristicCallback(void (*callback)(LEResponse LEResponse));
-  void setCharacteristicCallback(const char *characteristic_uuid, void (*callback)(LEResponse LEResponse));
+/**
+ * @brief Characteristics by registration order, with open addressing indexes on the pre-parsed UUID
+ * and on the BLECharacteristic pointer seen in stack callbacks.
+ */
+class LECharacteristicTable
+{
+public:
+  struct Entry
+  {
+    LEUUIDKey uuid;
+    BLECharacteristic *characteristic;
+    CharacteristicCallbacks *callbacks;
+    uint32_t properties;
+    BLEDescriptor *cccd;             // 0x2902, found by indexAttributes()
+    volatile uint32_t notifyMask;    // LEConnectionTable slots with notifications enabled
+    volatile uint32_t indicateMask;  // LEConnectionTable slots with indications enabled
+  };
 
-  void start();
+private:
+  std::vector<Entry> _entries;
+  std::vector<LEHandle> _slots;
+  std::vector<LEHandle> _pointerSlots;
+  std::vector<uint32_t> _cccdIndex;  // (attribute handle << 16) | LEHandle, sorted
+  std::vector<uint32_t> _valueIndex; // same for characteristic values
 
-  void notify(const char *characteristic_uuid, const char *data);
-  void notify(const char *characteristic_uuid, uint8_t *data, uint8_t size);
+  static LEHandle lookup(const std::vector<uint32_t> &index, uint16_t attributeHandle);
 
-  void setDebug(bool debug);
+  void insert(LEHandle handle);
+  void insertPointer(LEHandle handle);
+  static size_t pointerHash(const BLECharacteristic *characteristic) { return ((uintptr_t)characteristic >> 2) * 2654435761u; }
 
-  BLEServer *getServer();
-  BLEService *getService(const char *service_uuid);
-  BLECharacteristic *getCharacteristic(const char *characteristic_uuid);
+public:
+  LEHandle add(const LEUUIDKey &uuid, BLECharacteristic *characteristic, uint32_t properties = 0);
+  void reserve(size_t count);
+  LEHandle find(const LEUUIDKey &uuid) const;
+  LEHandle find(const char *uuid) const;
+  LEHandle find(const BLECharacteristic *characteristic) const;
+
+  /**
+   * @brief Indexes value and Configuration descriptor attribute handles once they are assigned (after the services start).
+   */
+  void indexAttributes();
+  LEHandle findCCCD(uint16_t attributeHandle) const { return lookup(_cccdIndex, attributeHandle); }
+  LEHandle findValue(uint16_t attributeHandle) const { return lookup(_valueIndex, attributeHandle); }
+
+  Entry *at(LEHandle handle) { return handle < _entries.size() ? &_entries[handle] : nullptr; }
+
+  BLECharacteristic *get(LEHandle handle) const { return handle < _entries.size() ? _entries[handle].characteristic : nullptr; }
+  const LEUUIDKey *getUUID(LEHandle handle) const { return handle < _entries.size() ? &_entries[handle].uuid : nullptr; }
+  CharacteristicCallbacks *getCallbacks(LEHandle handle) const { return handle < _entries.size() ? _entries[handle].callbacks : nullptr; }
+  void setCallbacks(LEHandle handle, CharacteristicCallbacks *callbacks)
+  {
+    if (handle < _entries.size())
+      _entries[handle].callbacks = callbacks;
+  }
+  size_t count() const { return _entries.size(); }
+  void clear();
 };
 
 class ServerCallback : public BLEServerCallbacks
 {
 public:
-  void setOnConnectCallback(void (*callback)(LEClient LEClient))
+  void setOnConnectCallback(LEPeerCallback callback)
   {
     onConnectCallback = callback;
   };
-  void setOnDisconnectCallback(void (*callback)(LEClient LEClient))
+  void setOnDisconnectCallback(LEPeerCallback callback)
   {
     onDisconnectCallback = callback;
   };
 
   bool _debug = false;
+  LEServerDispatcher *_dispatcher = nullptr;
+  LEServer *_server = nullptr;
+  LEConnectionTable connections;
+
+  void deliver(LEServerEvent::Type type, uint16_t id, const uint8_t *address, uint16_t count)
+  {
+    const LEPeerCallback &callback = type == LEServerEvent::Connect ? onConnectCallback : onDisconnectCallback;
+    if (!callback)
+      return;
+
+    char addressStr[18];
+    snprintf(addressStr, sizeof(addressStr), "%02x:%02x:%02x:%02x:%02x:%02x", address[0], address[1], address[2], address[3], address[4], address[5]);
+
+    LEClient LEClient;
+    LEClient.address = addressStr;
+    LEClient.id = id;
+    LEClient.count = count;
+
+    callback(LEClient);
+  }
 
 private:
   uint16_t clientCount = 0;
 
-  void (*onConnectCallback)(LEClient LEClient);
-  void (*onDisconnectCallback)(LEClient LEClient);
+  LEPeerCallback onConnectCallback;
+  LEPeerCallback onDisconnectCallback;
+
+  void dispatch(LEServerEvent::Type type, uint16_t id, const uint8_t *address)
+  {
+    if (_dispatcher != nullptr && _dispatcher->isDeferred())
+    {
+      LEServerEvent event;
+      event.type = type;
+      event.target = this;
+      event.count = clientCount;
+      event.view.connId = id;
+      memcpy(event.view.address, address, sizeof(event.view.address));
+      _dispatcher->post(event);
+    }
+    else
+    {
+      deliver(type, id, address, clientCount);
+    }
+  }
 
   void onConnect(BLEServer *pServer, esp_ble_gatts_cb_param_t *param)
   {
     /* Get the MAC address of the connected LEClient */
     uint16_t ClientID = param->connect.conn_id;
-    BLEAddress ClientAddress = param->connect.remote_bda;
 
     BLEDevice::startAdvertising();
 
     clientCount++;
-
-    LEClient LEClient;
-    LEClient.address = ClientAddress.toString().c_str();
-    LEClient.id = ClientID;
-    LEClient.count = clientCount;
+    connections.add(ClientID, param->connect.remote_bda, param->connect.conn_params);
 
     if (_debug)
     {
+      BLEAddress ClientAddress = param->connect.remote_bda;
       Serial.print("Client Connected    , Id : ");
-      Serial.print(LEClient.id);
+      Serial.print(ClientID);
       Serial.print(" , Adress : ");
-      Serial.print(LEClient.address);
+      Serial.print(ClientAddress.toString().c_str());
       Serial.print(" , Connected Devices : ");
-      Serial.println(LEClient.count);
+      Serial.println(clientCount);
     }
 
-    if (onConnectCallback != nullptr)
-    {
-      onConnectCallback(LEClient);
-    }
+    dispatch(LEServerEvent::Connect, ClientID, param->connect.remote_bda);
   };
 
-  void onDisconnect(BLEServer *pServer, esp_ble_gatts_cb_param_t *param)
+  void onDisconnect(BLEServer *pServer, esp_ble_gatts_cb_param_t *param);
+
+  void onMtuChanged(BLEServer *pServer, esp_ble_gatts_cb_param_t *param)
   {
-    uint16_t ClientID = param->connect.conn_id;
-    BLEAddress ClientAddress = param->connect.remote_bda;
+    connections.setMtu(param->mtu.conn_id, param->mtu.mtu);
+  };
+};
 
-    clientCount--;
+class CharacteristicCallbacks : public BLECharacteristicCallbacks
+{
+public:
+  void setCharacteristicCallback(void (*callback)(LEResponse LEResponse))
+  {
+    characteristicCallback = callback;
+  }
+  void setCharacteristicCallback(LEResponseCallback callback)
+  {
+    viewCallback = callback;
+  }
+  void setTable(const LECharacteristicTable *table, LEHandle handle = LE_INVALID_HANDLE)
+  {
+    _table = table;
+    _handle = handle;
+  }
+  void setValueProvider(LEValueProvider provider, uint32_t ttl, uint8_t *buffer, size_t size)
+  {
+    _provider = provider;
+    _ttl = ttl;
+    _buffer = buffer;
+    _bufferSize = size;
+    _cached = false;
+  }
+  void invalidate() { _cached = false; }
 
-    LEClient LEClient;
-    LEClient.address = ClientAddress.toString().c_str();
-    LEClient.id = ClientID;
-    LEClient.count = clientCount;
+  void setReceiveBuffer(uint8_t *buffer, size_t capacity)
+  {
+    _receive.data = buffer;
+    _receive.capacity = capacity;
+    _receive.length = 0;
+    _receive.pending = false;
+    _receive.busy = false;
+  }
+  bool hasReceiveBuffer() const { return _receive.data != nullptr; }
+  LEReceiveStats getReceiveStats() const { return _receive.stats; }
 
-    if (_debug)
+  /**
+   * @brief Write or Prepare Write to a characteristic with a receive buffer, from the GATTS event.
+   */
+  void receive(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param)
+  {
+    LEReceiveBuffer &rx = _receive;
+    if (rx.busy)
     {
-      Serial.print("Client Disconnected , Id : ");
-      Serial.print(LEClient.id);
-      Serial.print(" , Adress : ");
-      Serial.print(LEClient.address);
-      Serial.print(" , Connected Devices : ");
-      Serial.println(LEClient.count);
+      rx.stats.overruns++;
+      rx.pending = false;
+      return;
     }
 
-    if (onDisconnectCallback != nullptr)
+    if (!param->write.is_prep)
     {
-      onDisconnectCallback(LEClient);
+      // the buffer holds another connection's half built prepared write
+      if (rx.pending && rx.connId != param->write.conn_id)
+      {
+        rx.stats.errors++;
+        return;
+      }
+      if (param->write.len > rx.capacity)
+      {
+        rx.stats.errors++;
+        return;
+      }
+      memcpy(rx.data, param->write.value, param->write.len);
+      rx.length = param->write.len;
+      complete(pCharacteristic, param->write.conn_id, param->write.bda);
+      return;
     }
-  };
-};
 
-class CharacteristicCallbacks : public BLECharacteristicCallbacks
-{
-public:
-  void setCharacteristicCallback(void (*callback)(LEResponse LEResponse))
+    if (!rx.pending)
+    {
+      rx.pending = true;
+      rx.error = false;
+      rx.length = 0;
+      rx.connId = param->write.conn_id;
+      memcpy(rx.address, param->write.bda, sizeof(rx.address));
+    }
+    else if (rx.connId != param->write.conn_id)
+    {
+      rx.stats.errors++;
+      return;
+    }
+
+    size_t end = (size_t)param->write.offset + param->write.len;
+    if (end > rx.capacity)
+    {
+      rx.error = true;
+      return;
+    }
+    memcpy(rx.data + param->write.offset, param->write.value, param->write.len);
+    if (end > rx.length)
+      rx.length = end;
+  }
+
+  void execute(BLECharacteristic *pCharacteristic, uint16_t connId, bool commit)
   {
-    characteristicCallback = callback;
+    LEReceiveBuffer &rx = _receive;
+    if (!rx.pending || rx.connId != connId)
+      return;
+
+    rx.pending = false;
+    if (!commit)
+      return;
+    if (rx.error)
+    {
+      rx.stats.errors++;
+      return;
+    }
+    complete(pCharacteristic, connId, rx.address);
+  }
+
+  void deliverReceived(LEResponseView view)
+  {
+    view.data = _receive.data;
+    deliver(view);
+    _receive.busy = false;
   }
 
+  // the queued message was dropped, the next write may reuse the buffer
+  void releaseReceived() { _receive.busy = false; }
+
   bool _debug = false;
+  LEServerDispatcher *_dispatcher = nullptr;
+  LEConnectionTable *_connections = nullptr;
+
+  void deliver(const LEResponseView &view)
+  {
+    if (viewCallback)
+    {
+      viewCallback(view);
+    }
+    if (characteristicCallback != nullptr)
+    {
+      characteristicCallback(view.toResponse());
+    }
+  }
 
 private:
-  void (*characteristicCallback)(LEResponse LEResponse);
+  void (*characteristicCallback)(LEResponse LEResponse) = nullptr;
+  LEResponseCallback viewCallback;
+  const LECharacteristicTable *_table = nullptr;
+  LEHandle _handle = LE_INVALID_HANDLE;
   int i=0;
-  void onWrite(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param)
+
+  LEValueProvider _provider;
+  uint32_t _ttl = 0;
+  uint32_t _sampledAt = 0;
+  volatile bool _cached = false;
+  uint8_t *_buffer = nullptr; // shared by every provider, reads are handled one at a time on the BLE task
+  size_t _bufferSize = 0;
+
+  LEReceiveBuffer _receive;
+
+  void complete(BLECharacteristic *pCharacteristic, uint16_t connId, const uint8_t *address)
+  {
+    LEResponseView view;
+    view.state = LEState::onWrite;
+    fill(view, pCharacteristic, connId, address);
+    view.data = _receive.data;
+    view.length = _receive.length;
+
+    _receive.stats.messages++;
+    if (_connections != nullptr)
+      _connections->addRx(connId, view.length);
+
+    if (_debug)
+      Serial.printf("Write Received, Id : %u , Length : %u\n", connId, (unsigned)view.length);
+
+    if (_dispatcher == nullptr || !_dispatcher->isDeferred())
+    {
+      deliver(view);
+      return;
+    }
+    if (!viewCallback && characteristicCallback == nullptr)
+      return;
+
+    // delivered in place, the buffer is held until the callback returns
+    LEServerEvent event;
+    event.type = LEServerEvent::Received;
+    event.target = this;
+    event.view = view;
+    _receive.busy = true;
+    if (!_dispatcher->post(event))
+      _receive.busy = false;
+  }
+
+  void provide(BLECharacteristic *pCharacteristic)
+  {
+    if (!_provider || (_cached && millis() - _sampledAt < _ttl))
+      return;
+
+    size_t length = _provider(_handle, _buffer, _bufferSize);
+    if (length == 0)
+      return;
+    if (length > _bufferSize)
+      length = _bufferSize;
+
+    pCharacteristic->setValue(_buffer, length);
+    _sampledAt = millis();
+    _cached = _ttl > 0;
+  }
+
+  void fill(LEResponseView &view, BLECharacteristic *pCharacteristic, uint16_t connId, const uint8_t *address)
   {
+    view.handle = _handle;
+    if (view.handle == LE_INVALID_HANDLE && _table != nullptr)
+      view.handle = _table->find(pCharacteristic);
+    view.uuid = _table != nullptr ? _table->getUUID(view.handle) : nullptr;
+    view.connId = connId;
+    memcpy(view.address, address, sizeof(view.address));
+    view.characteristic = pCharacteristic;
+    view.data = nullptr;
+    view.length = 0;
+  }
 
-    BLEAddress clientAddress = param->write.bda;
+  void dispatch(const LEResponseView &view)
+  {
+    if (_dispatcher == nullptr || !_dispatcher->isDeferred())
+    {
+      deliver(view);
+      return;
+    }
+    if (!viewCallback && characteristicCallback == nullptr)
+      return;
+
+    LEServerEvent event;
+    event.type = LEServerEvent::Characteristic;
+    event.target = this;
+    event.view = view;
+    if (view.length > sizeof(event.data))
+    {
+      event.view.length = sizeof(event.data);
+      _dispatcher->noteTruncated();
+    }
+    if (event.view.length > 0)
+      memcpy(event.data, view.data, event.view.length);
+    _dispatcher->post(event);
+  }
 
-    LEResponse response;
+  void onWrite(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param)
+  {
+    // reassembled and reported by receive() / execute()
+    if (hasReceiveBuffer())
+      return;
+
+    LEResponseView response;
 
     response.state = LEState::onWrite;
-    response.clientAddress = clientAddress.toString().c_str();
-    response.uuid.set(pCharacteristic->getUUID());
-    response.uuidStr = pCharacteristic->getUUID().toString().c_str();
-    response.data = pCharacteristic->getValue().c_str();
-    response.dataPtr = pCharacteristic->getData();
-    response.size = pCharacteristic->getLength();
+    fill(response, pCharacteristic, param->write.conn_id, param->write.bda);
+    // the characteristic value already holds the whole (possibly long) write
+    response.data = pCharacteristic->getData();
+    response.length = pCharacteristic->getLength();
+    if (_connections != nullptr)
+      _connections->addRx(response.connId, response.length);
 
     if (_debug)
     {
-      //Serial.println();
-      // Serial.println("Receiving New Data.");
-      // Serial.print("Client Address: ");
-      // Serial.println(response.clientAddress);
-      // Serial.print("Characteristic uuid: ");
-      // Serial.println(response.uuidStr);
-      // Serial.print("Data Length: ");
-      // Serial.println(response.size);
-      // Serial.print("Data String: ");
-      // Serial.println(response.data);
-
-      // Serial.print("Data DEC: ");
-      // for (size_t i = 0; i < response.size; i++)
-      // {
-      //   Serial.printf("%02d", *(response.dataPtr + i));
-      //   if (i < response.size - 1)
-      //     Serial.print("-");
-      // }
-      // Serial.println();
-      
-      //Serial.print("Data HEX: ");
       Serial.printf("uint8_t data%d[] = {",i);
-      for (size_t i = 0; i < response.size; i++)
+      for (size_t i = 0; i < response.length; i++)
       {
-        Serial.printf("0x%02X", *(response.dataPtr + i));
-        if (i < response.size - 1)
+        Serial.printf("0x%02X", response.data[i]);
+        if (i + 1 < response.length)
           Serial.print(",");
       }
       Serial.print("};");
@@ -248,36 +662,32 @@ private:
       i++;
     }
 
-    if (characteristicCallback != nullptr)
-    {
-      characteristicCallback(response);
-    }
+    dispatch(response);
   }
 
   void onRead(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param)
   {
-    BLEAddress clientAddress = param->write.bda;
-    LEResponse response;
+    LEResponseView response;
 
     response.state = LEState::onRead;
-    response.clientAddress = clientAddress.toString().c_str();
-    response.uuid.set(pCharacteristic->getUUID());
-    response.uuidStr = pCharacteristic->getUUID().toString().c_str();
+    fill(response, pCharacteristic, param->read.conn_id, param->read.bda);
+
+    // runs before the stack builds the read response from the characteristic value
+    provide(pCharacteristic);
 
     if (_debug)
     {
+      char address[18];
+      response.getAddress(address);
       Serial.println();
       Serial.println("Read Detected.");
       Serial.print("Client Address: ");
-      Serial.println(response.clientAddress);
+      Serial.println(address);
       Serial.print("Characteristic uuid: ");
-      Serial.println(response.uuidStr);
+      Serial.println(response.getUUID());
     }
 
-    if (characteristicCallback != nullptr)
-    {
-      characteristicCallback(response);
-    }
+    dispatch(response);
   }
 
   // void onNotify(BLECharacteristic *pCharacteristic)
@@ -329,4 +739,175 @@ private:
   // }
 };
 
-#endif // LEServer_H
\ No newline at end of file
+class LEServer
+{
+private:
+  BLEServer *pServer = NULL;
+  String _deviceName;
+  bool _debug = false;
+  LECharacteristicTable _characteristics;
+  LEServerDispatcher _events;
+  uint8_t _streamId = 0;
+  LESubscriptionCallback _subscriptionCallback;
+  LELinkCallback _linkCallback;
+  LELinkParams _linkParams = {0, 0, 0, 0, 0, 0, 0};
+  LELinkTuner _linkTuner;
+
+  ServerCallback _serverCallback;
+  CharacteristicCallbacks _allCallbacks; // shared by characteristics without their own callback
+  LEPool<CharacteristicCallbacks, LE_MAX_CHARACTERISTICS> _callbackPool;
+  LEPool<BLEDescriptor, LE_MAX_DESCRIPTORS> _descriptorPool;
+  BLEService *_services[LE_MAX_SERVICES];
+  uint8_t _providerBuffer[LE_PROVIDER_BUFFER_SIZE];
+  uint8_t _serviceCount = 0;
+
+  static LEServer *_instance;
+
+  friend class ServerCallback;
+
+  static void deliverEvent(const LEServerEvent &event, void *context);
+  static void releaseEvent(const LEServerEvent &event, void *context);
+  LEHandle createCharacteristic(BLEService *pService, const LEUUIDKey &uuid, uint32_t properties);
+  static void handleGattsEvent(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param);
+  static void handleGapEvent(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
+  void reportLink(uint16_t connId);
+  void reportLink(const LELinkInfo &link);
+  void onConfigurationWrite(uint16_t connId, uint16_t attributeHandle, const uint8_t *value);
+  void clearSubscriptions(uint16_t connId);
+  void subscriptionChanged(LEHandle handle, uint16_t connId, uint32_t bit);
+
+public:
+  /**
+   * @brief Initializes the stack and the GATT server, again after end() the same server is reused.
+   */
+  void createServer(const char *name);
+
+  /**
+   * @brief Disconnects every client, removes and frees all services, characteristics, descriptors
+   * and callback objects so a new profile can be built without rebooting. In the deferred modes,
+   * events still queued (the disconnects included) are delivered from end() on the calling task.
+   */
+  void end();
+
+  void addService(const char *uuid);
+
+  LEHandle addCharacteristic(const char *service_uuid, const char *characteristic_uuid, uint32_t properties);
+
+  void addDescriptor(const char *characteristic_uuid, uint16_t dicreptor_uuid, const char *descriptor_value = NULL);
+  void addDescriptor(const char *characteristic_uuid, uint16_t dicreptor_uuid, uint8_t *data, size_t size);
+  void addDescriptor(LEHandle handle, uint16_t dicreptor_uuid, const char *descriptor_value = NULL);
+  void addDescriptor(LEHandle handle, uint16_t dicreptor_uuid, uint8_t *data, size_t size);
+
+  /**
+   * @brief Creates every service, characteristic and descriptor of a LESchema table in one pass,
+   * each service sized to the handles it needs. Returns false if a service could not be created.
+   */
+  bool addSchema(const LEServiceDef *services, size_t count);
+  template <size_t N>
+  bool addSchema(const LEServiceDef (&services)[N]) { return addSchema(services, N); }
+
+  void updateDescriptor(uint16_t dicreptor_uuid, const char *descriptor_value);
+  void updateDescriptor(uint16_t dicreptor_uuid, uint8_t *data, size_t size);
+
+  /**
+   * @brief Callbacks accept functions, member functions through LEDelegate::bind and lambdas with small captures.
+   */
+  void setOnConnectCallback(LEPeerCallback callback);
+  void setOnDisconnectCallback(LEPeerCallback callback);
+
+  void setAllCharacteristicCallback(LEResponseCallback callback);
+  void setCharacteristicCallback(const char *characteristic_uuid, LEResponseCallback callback);
+  void setCharacteristicCallback(LEHandle handle, LEResponseCallback callback);
+
+  // Compatibility path, builds a String based LEResponse for every event.
+  void setAllCharacteristicCallback(void (*callback)(LEResponse LEResponse));
+  void setCharacteristicCallback(const char *characteristic_uuid, void (*callback)(LEResponse LEResponse));
+  void setCharacteristicCallback(LEHandle handle, void (*callback)(LEResponse LEResponse));
+
+  /**
+   * @brief Samples the value when a client reads it instead of keeping it updated from loop().
+   * With ttl_ms > 0 reads within the window are served from the last sample.
+   */
+  bool setValueProvider(LEHandle handle, LEValueProvider provider, uint32_t ttl_ms = 0);
+  bool setValueProvider(const char *characteristic_uuid, LEValueProvider provider, uint32_t ttl_ms = 0);
+  void invalidateValue(LEHandle handle);
+
+  /**
+   * @brief Writes to the characteristic, including long (Prepare/Execute) writes up to capacity bytes,
+   * are reassembled into buffer and reported with one callback per completed write.
+   * The buffer is read only for the duration of the callback. ATT caps a value at 512 bytes, and
+   * BLECharacteristic still keeps its own heap copy of prepared writes.
+   */
+  bool setReceiveBuffer(LEHandle handle, uint8_t *buffer, size_t capacity);
+  LEReceiveStats getReceiveStats(LEHandle handle);
+
+  void start();
+
+  void notify(const char *characteristic_uuid, const char *data);
+  void notify(const char *characteristic_uuid, uint8_t *data, size_t size);
+  void notify(LEHandle handle, const char *data);
+  void notify(LEHandle handle, uint8_t *data, size_t size);
+
+  /**
+   * @brief Sends a buffer of any length as LEStream framed notifications sized to the smallest peer MTU.
+   * Blocks until every fragment is handed to the controller or timeout_ms elapses.
+   */
+  bool stream(LEHandle handle, const uint8_t *data, size_t length, uint32_t timeout_ms = 2000);
+
+  /**
+   * @brief Notifies a single connection (indicates when it only enabled indications), the characteristic value seen by reads is left unchanged.
+   */
+  bool notify(uint16_t conn_id, LEHandle handle, const uint8_t *data, size_t size);
+  bool notify(uint16_t conn_id, const char *characteristic_uuid, const uint8_t *data, size_t size);
+
+  /**
+   * @brief Subscription state written by clients to the Configuration (0x2902) descriptor.
+   * notify() skips characteristics that have the descriptor but no subscriber.
+   */
+  bool isSubscribed(LEHandle handle);
+  bool isSubscribed(const char *characteristic_uuid);
+  bool isSubscribed(uint16_t conn_id, LEHandle handle);
+  uint8_t getSubscriberCount(LEHandle handle);
+  void setSubscriptionCallback(LESubscriptionCallback callback);
+
+  uint8_t getConnectionCount();
+  uint8_t getConnections(LEConnection *connections, uint8_t max);
+  bool getConnection(uint16_t conn_id, LEConnection &connection);
+  void forEachConnection(LEConnectionCallback callback);
+
+  /**
+   * @brief Connection settings requested on every new connection. The client starts the MTU exchange,
+   * params.mtu only sets the largest MTU the server accepts.
+   */
+  bool setLinkParams(const LELinkParams &params);
+  bool setLinkProfile(LELinkProfile profile);
+  /**
+   * @brief Asks the central for new settings, the negotiated values reach getLinkInfo() and the link callback
+   * once it answered. The callback also runs when a client connects, with its initial values.
+   * Returns false for an MTU other than the one already exchanged, leave it at 0.
+   */
+  bool tuneLink(uint16_t conn_id, const LELinkParams &params);
+  bool tuneLink(uint16_t conn_id, LELinkProfile profile);
+  bool getLinkInfo(uint16_t conn_id, LELinkInfo &info);
+  void setLinkCallback(LELinkCallback callback);
+
+  void setDebug(bool debug);
+
+  /**
+   * @brief Run user callbacks on the BLE task (default), from poll() or from a worker task pinned to core.
+   */
+  bool setDispatchMode(LEDispatchMode mode, LEDropPolicy policy = LEDropNewest, int core = 1, uint8_t priority = 1);
+  uint32_t poll();
+  LEQueueStats getQueueStats();
+
+  BLEServer *getServer();
+  BLEService *getService(const char *service_uuid);
+  BLECharacteristic *getCharacteristic(const char *characteristic_uuid);
+  BLECharacteristic *getCharacteristic(LEHandle handle);
+  LEHandle getHandle(const char *characteristic_uuid);
+
+private:
+  CharacteristicCallbacks *getCharacteristicCallbacks(LEHandle handle);
+};
+
+#endif // LEServer_H
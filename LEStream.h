@@ -0,0 +1,176 @@
+#ifndef LEStream_H
+#define LEStream_H
+
+#include <Arduino.h>
+#include <new>
+
+/**
+ * @brief Framing used by LEServer::stream and LECharacteristic::setStreamCallback.
+ * Every fragment starts with (little endian):
+ *   [0]    message id
+ *   [1]    flags, LE_STREAM_START and/or LE_STREAM_END
+ *   [2..3] fragment index within the message
+ * The start fragment adds [4..7], the total message length.
+ */
+#define LE_STREAM_START 0x01
+#define LE_STREAM_END 0x02
+#define LE_STREAM_HEADER_SIZE 4
+#define LE_STREAM_START_HEADER_SIZE 8
+
+struct LEStreamStats
+{
+  uint32_t messages;
+  uint32_t errors;   // out of order, missing or oversized fragments
+  uint32_t overruns; // fragments dropped while a completed message was still undelivered
+};
+
+struct LEStreamHeader
+{
+  uint8_t messageId;
+  uint8_t flags;
+  uint16_t index;
+  uint32_t totalLength;
+
+  size_t size() const { return (flags & LE_STREAM_START) ? LE_STREAM_START_HEADER_SIZE : LE_STREAM_HEADER_SIZE; }
+
+  size_t encode(uint8_t *buffer) const
+  {
+    buffer[0] = messageId;
+    buffer[1] = flags;
+    buffer[2] = index & 0xFF;
+    buffer[3] = index >> 8;
+    if (flags & LE_STREAM_START)
+    {
+      buffer[4] = totalLength & 0xFF;
+      buffer[5] = (totalLength >> 8) & 0xFF;
+      buffer[6] = (totalLength >> 16) & 0xFF;
+      buffer[7] = (totalLength >> 24) & 0xFF;
+    }
+    return size();
+  }
+
+  bool decode(const uint8_t *buffer, size_t length)
+  {
+    if (length < LE_STREAM_HEADER_SIZE)
+      return false;
+    messageId = buffer[0];
+    flags = buffer[1];
+    index = buffer[2] | (buffer[3] << 8);
+    totalLength = 0;
+    if (flags & LE_STREAM_START)
+    {
+      if (length < LE_STREAM_START_HEADER_SIZE)
+        return false;
+      totalLength = buffer[4] | (buffer[5] << 8) | ((uint32_t)buffer[6] << 16) | ((uint32_t)buffer[7] << 24);
+    }
+    return true;
+  }
+};
+
+/**
+ * @brief Rebuilds framed messages into a buffer allocated once in begin().
+ * feed() returns true when a message is complete, it stays in data() until release().
+ */
+class LEStreamReassembler
+{
+private:
+  uint8_t *_buffer = nullptr;
+  size_t _capacity = 0;
+  size_t _received = 0;
+  size_t _total = 0;
+  uint16_t _nextIndex = 0;
+  uint8_t _messageId = 0;
+  bool _active = false;
+  volatile bool _complete = false;
+  LEStreamStats _stats = {0, 0, 0};
+
+public:
+  ~LEStreamReassembler() { delete[] _buffer; }
+
+  /**
+   * @brief The BLE task may be feeding the buffer, or a queued Stream event still point at it,
+   * so a second begin() never reallocates: it succeeds when the existing buffer is large enough.
+   */
+  bool begin(size_t maxLength)
+  {
+    if (_buffer != nullptr)
+      return maxLength <= _capacity;
+
+    _buffer = new (std::nothrow) uint8_t[maxLength];
+    _capacity = _buffer != nullptr ? maxLength : 0;
+    _active = false;
+    _complete = false;
+    return _buffer != nullptr;
+  }
+
+  bool feed(const uint8_t *fragment, size_t length)
+  {
+    if (_complete)
+    {
+      _stats.overruns++;
+      return false;
+    }
+
+    LEStreamHeader header;
+    if (!header.decode(fragment, length))
+    {
+      _stats.errors++;
+      _active = false;
+      return false;
+    }
+
+    if (header.flags & LE_STREAM_START)
+    {
+      if (_active)
+        _stats.errors++; // previous message never finished
+      _active = header.totalLength <= _capacity && header.index == 0;
+      if (!_active)
+      {
+        _stats.errors++;
+        return false;
+      }
+      _messageId = header.messageId;
+      _total = header.totalLength;
+      _received = 0;
+      _nextIndex = 0;
+    }
+    else if (!_active)
+    {
+      return false; // tail of a message we already rejected
+    }
+
+    size_t payload = length - header.size();
+    if (header.messageId != _messageId || header.index != _nextIndex || _received + payload > _total)
+    {
+      _stats.errors++;
+      _active = false;
+      return false;
+    }
+
+    memcpy(_buffer + _received, fragment + header.size(), payload);
+    _received += payload;
+    _nextIndex++;
+
+    if (header.flags & LE_STREAM_END)
+    {
+      _active = false;
+      if (_received != _total)
+      {
+        _stats.errors++;
+        return false;
+      }
+      _stats.messages++;
+      _complete = true;
+      return true;
+    }
+    return false;
+  }
+
+  uint8_t *data() { return _buffer; }
+  size_t length() const { return _received; }
+  void release() { _complete = false; }
+  void reset() { _active = false; } // drops a partially received message, e.g. after a link loss
+  LEStreamStats getStats() const { return _stats; }
+};
+
+#endif // LEStream_H
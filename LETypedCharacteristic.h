@@ -0,0 +1,74 @@
+#ifndef LETypedCharacteristic_H
+#define LETypedCharacteristic_H
+
+#include <LEServer.h>
+#include <LEPacked.h>
+
+/**
+ * @brief Server characteristic carrying one value of T in LEPacked encoding.
+ *
+ *   struct __attribute__((packed)) Sample { uint32_t time; float temperature; };
+ *   LETypedCharacteristic<Sample> samples(server, handle);
+ *   samples.notify(sample);
+ */
+template <typename T>
+class LETypedCharacteristic
+{
+private:
+  LEServer &_server;
+  LEHandle _handle;
+
+public:
+  LETypedCharacteristic(LEServer &server, LEHandle handle) : _server(server), _handle(handle) {}
+  LETypedCharacteristic(LEServer &server, const char *characteristic_uuid) : _server(server), _handle(server.getHandle(characteristic_uuid)) {}
+
+  LEHandle getHandle() const { return _handle; }
+
+  /**
+   * @brief Sets the value returned to reads without notifying.
+   */
+  void set(const T &value)
+  {
+    BLECharacteristic *pCharacteristic = _server.getCharacteristic(_handle);
+    if (pCharacteristic == nullptr)
+      return;
+    uint8_t buffer[sizeof(T)];
+    LEPacked<T>::encode(value, buffer);
+    pCharacteristic->setValue(buffer, sizeof(buffer));
+  }
+
+  /**
+   * @brief Current value, the last set(), notify() or client write. False when the length does not match T.
+   */
+  bool get(T &value)
+  {
+    BLECharacteristic *pCharacteristic = _server.getCharacteristic(_handle);
+    if (pCharacteristic == nullptr)
+      return false;
+    return LEPacked<T>::decode(pCharacteristic->getData(), pCharacteristic->getLength(), value);
+  }
+
+  void notify(const T &value)
+  {
+    uint8_t buffer[sizeof(T)];
+    LEPacked<T>::encode(value, buffer);
+    _server.notify(_handle, buffer, sizeof(buffer));
+  }
+
+  bool notify(uint16_t conn_id, const T &value)
+  {
+    uint8_t buffer[sizeof(T)];
+    LEPacked<T>::encode(value, buffer);
+    return _server.notify(conn_id, _handle, buffer, sizeof(buffer));
+  }
+
+  /**
+   * @brief Decodes a client write delivered to a characteristic callback.
+   */
+  static bool decode(const LEResponseView &response, T &value)
+  {
+    return LEPacked<T>::decode(response.data, response.length, value);
+  }
+};
+
+#endif // LETypedCharacteristic_H
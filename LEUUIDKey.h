@@ -0,0 +1,135 @@
+#ifndef LEUUIDKey_H
+#define LEUUIDKey_H
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+
+/**
+ * @brief Pre-parsed 128-bit UUID, stored least significant byte first like esp_bt_uuid_t.
+ * 16 and 32-bit UUIDs are expanded on the Bluetooth base UUID so all forms of one UUID compare equal.
+ */
+struct LEUUIDKey
+{
+  uint8_t bytes[16];
+
+  bool operator==(const LEUUIDKey &other) const { return memcmp(bytes, other.bytes, sizeof(bytes)) == 0; }
+  bool operator!=(const LEUUIDKey &other) const { return !(*this == other); }
+
+  uint32_t hash() const
+  {
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < sizeof(bytes); i++)
+    {
+      hash ^= bytes[i];
+      hash *= 16777619u;
+    }
+    return hash;
+  }
+
+  bool isBased() const
+  {
+    LEUUIDKey base = LEUUIDKey::base();
+    return memcmp(bytes, base.bytes, 12) == 0;
+  }
+
+  BLEUUID toBLEUUID() const
+  {
+    if (isBased())
+    {
+      uint32_t value = bytes[12] | (bytes[13] << 8) | ((uint32_t)bytes[14] << 16) | ((uint32_t)bytes[15] << 24);
+      if (value <= 0xFFFF)
+        return BLEUUID((uint16_t)value);
+      return BLEUUID(value);
+    }
+    esp_bt_uuid_t native;
+    native.len = ESP_UUID_LEN_128;
+    memcpy(native.uuid.uuid128, bytes, sizeof(bytes));
+    return BLEUUID(native);
+  }
+
+  static LEUUIDKey base()
+  {
+    LEUUIDKey key = {{0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}};
+    return key;
+  }
+
+  static LEUUIDKey from16(uint16_t uuid)
+  {
+    LEUUIDKey key = base();
+    key.bytes[12] = uuid & 0xFF;
+    key.bytes[13] = uuid >> 8;
+    return key;
+  }
+
+  static LEUUIDKey fromBLEUUID(BLEUUID uuid)
+  {
+    LEUUIDKey key;
+    BLEUUID uuid128 = uuid.to128();
+    memcpy(key.bytes, uuid128.getNative()->uuid.uuid128, sizeof(key.bytes));
+    return key;
+  }
+
+  /**
+   * @brief Parses "xxxx", "xxxxxxxx" or the 36 character form without touching the heap.
+   */
+  static bool fromString(const char *uuid, LEUUIDKey &key)
+  {
+    if (uuid == nullptr)
+      return false;
+
+    size_t length = strlen(uuid);
+    key = base();
+
+    if (length == 4 || length == 8)
+    {
+      uint32_t value = 0;
+      for (size_t i = 0; i < length; i++)
+      {
+        int8_t nibble = hexValue(uuid[i]);
+        if (nibble < 0)
+          return false;
+        value = (value << 4) | nibble;
+      }
+      key.bytes[12] = value & 0xFF;
+      key.bytes[13] = (value >> 8) & 0xFF;
+      key.bytes[14] = (value >> 16) & 0xFF;
+      key.bytes[15] = (value >> 24) & 0xFF;
+      return true;
+    }
+
+    if (length != 36)
+      return false;
+
+    size_t byteIndex = sizeof(key.bytes);
+    for (size_t i = 0; i < length;)
+    {
+      if (i == 8 || i == 13 || i == 18 || i == 23)
+      {
+        if (uuid[i] != '-')
+          return false;
+        i++;
+        continue;
+      }
+      int8_t high = hexValue(uuid[i]);
+      int8_t low = hexValue(uuid[i + 1]);
+      if (high < 0 || low < 0)
+        return false;
+      key.bytes[--byteIndex] = (high << 4) | low;
+      i += 2;
+    }
+    return true;
+  }
+
+  static int8_t hexValue(char c)
+  {
+    if (c >= '0' && c <= '9')
+      return c - '0';
+    if (c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+      return c - 'A' + 10;
+    return -1;
+  }
+};
+
+#endif // LEUUIDKey_H